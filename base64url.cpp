@@ -0,0 +1,83 @@
+#include "base64url.h"
+
+#include <array>
+
+std::string base64url_encode(const std::string& bin) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+        "abcdefghijklmnopqrstuvwxyz"
+        "0123456789-_"; // base64url alphabet: '+' -> '-', '/' -> '_'
+    size_t len = bin.size();
+    std::string out;
+    out.reserve(((len + 2) / 3) * 4);
+
+    size_t i = 0;
+    while (i + 2 < len) {
+        unsigned int b0 = static_cast<unsigned char>(bin[i]);
+        unsigned int b1 = static_cast<unsigned char>(bin[i + 1]);
+        unsigned int b2 = static_cast<unsigned char>(bin[i + 2]);
+        out.push_back(alphabet[(b0 >> 2) & 0x3F]);
+        out.push_back(alphabet[((b0 & 0x3) << 4) | ((b1 >> 4) & 0xF)]);
+        out.push_back(alphabet[((b1 & 0xF) << 2) | ((b2 >> 6) & 0x3)]);
+        out.push_back(alphabet[b2 & 0x3F]);
+        i += 3;
+    }
+
+    size_t rem = len - i;
+    if (rem == 1) {
+        unsigned int b0 = static_cast<unsigned char>(bin[i]);
+        out.push_back(alphabet[(b0 >> 2) & 0x3F]);
+        out.push_back(alphabet[((b0 & 0x3) << 4) & 0x3F]);
+        // no padding
+    }
+    else if (rem == 2) {
+        unsigned int b0 = static_cast<unsigned char>(bin[i]);
+        unsigned int b1 = static_cast<unsigned char>(bin[i + 1]);
+        out.push_back(alphabet[(b0 >> 2) & 0x3F]);
+        out.push_back(alphabet[((b0 & 0x3) << 4) | ((b1 >> 4) & 0xF)]);
+        out.push_back(alphabet[((b1 & 0xF) << 2) & 0x3F]);
+        // no padding
+    }
+
+    return out;
+}
+
+bool base64url_decode(std::string_view text, std::string& bin) {
+    static const auto lookup = [] {
+        std::array<signed char, 256> table{};
+        table.fill(-1);
+        const char alphabet[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+            "abcdefghijklmnopqrstuvwxyz"
+            "0123456789-_";
+        for (int i = 0; i < 64; ++i)
+            table[static_cast<unsigned char>(alphabet[i])] = static_cast<signed char>(i);
+        return table;
+    }();
+
+    // Padding is tolerated although we never produce it.
+    while (!text.empty() && text.back() == '=')
+        text.remove_suffix(1);
+
+    if (text.size() % 4 == 1)
+        return false;
+
+    bin.clear();
+    bin.reserve(text.size() * 3 / 4);
+
+    unsigned int acc = 0;
+    int bits = 0;
+    for (char c : text) {
+        const int v = lookup[static_cast<unsigned char>(c)];
+        if (v < 0)
+            return false;
+        acc = (acc << 6) | static_cast<unsigned int>(v);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            bin.push_back(static_cast<char>((acc >> bits) & 0xFF));
+        }
+    }
+
+    return true;
+}
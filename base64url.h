@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// URL-safe Base64 (RFC 4648 #5) without padding.
+// Input `bin` contains raw bytes (may have '\0' bytes).
+std::string base64url_encode(const std::string& bin);
+
+// Returns false on characters outside of the base64url alphabet.
+bool base64url_decode(std::string_view text, std::string& bin);
@@ -0,0 +1,234 @@
+#include "call_setup_benchmark.h"
+
+#include "isendrecv.h"
+#include "sendrecv.h"
+
+#include <crossguid/guid.hpp>
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+
+namespace {
+
+const char MILESTONE_PREFIX[] = "Call setup: ";
+const char FINAL_MILESTONE[] = "first decoded frame";
+const char* const MILESTONES[] = {
+    "SYN/ACK", "offer/answer", "ICE connected", "DTLS connected", FINAL_MILESTONE
+};
+
+// A call that has not decoded a frame by then is not going to.
+const guint BENCHMARK_TIMEOUT_MS = 30000;
+
+// A peer hangs up on its own if the benchmark went away without stopping it.
+const guint PEER_TIMEOUT_MS = 2 * BENCHMARK_TIMEOUT_MS;
+
+enum { PEERS = 2 };
+
+class BenchmarkPeer : public ISendRecv
+{
+public:
+    explicit BenchmarkPeer(GMainLoop* loop) : loop(loop) {}
+
+    std::function<void()> setSendLambda(std::function<void(const std::string&)>) override { return {}; }
+    std::function<void()> setAudioVolumeLambda(std::function<void(int)>) override { return {}; }
+    void onQuit() override { g_main_loop_quit(loop); }
+    void handleRecv(uintptr_t, const char*) override {}
+
+private:
+    GMainLoop* loop;
+};
+
+struct Benchmark;
+
+struct Peer
+{
+    Benchmark* benchmark = nullptr;
+    int number = 0;
+    GSubprocess* process = nullptr;
+    GDataInputStream* output = nullptr;
+    std::map<std::string, long long> milestones;
+    bool finished = false;              // decoded a frame, or its output closed
+    bool reading = false;
+};
+
+struct Benchmark
+{
+    GMainLoop* loop = nullptr;
+    Peer peers[PEERS];
+
+    void check_done()
+    {
+        for (const auto& peer : peers) {
+            if (!peer.finished)
+                return;
+        }
+        g_main_loop_quit(loop);
+    }
+};
+
+void read_next_line(Peer* peer);
+
+void on_peer_line(GObject* source, GAsyncResult* result, gpointer user_data)
+{
+    auto peer = static_cast<Peer*>(user_data);
+    peer->reading = false;
+
+    gsize length = 0;
+    auto line = g_data_input_stream_read_line_finish_utf8(G_DATA_INPUT_STREAM(source), result, &length, nullptr);
+    if (!line) {
+        peer->finished = true;
+        peer->benchmark->check_done();
+        return;
+    }
+
+    // "Call setup: <milestone> after <n> ms"
+    const char* after = g_str_has_prefix(line, MILESTONE_PREFIX) ? g_strrstr(line, " after ") : nullptr;
+    if (after) {
+        const char* name = line + strlen(MILESTONE_PREFIX);
+        const std::string milestone(name, after);
+        peer->milestones.emplace(milestone, strtoll(after + strlen(" after "), nullptr, 10));
+        gst_print("peer %d: %s\n", peer->number, line);
+
+        if (milestone == FINAL_MILESTONE && !peer->finished) {
+            peer->finished = true;
+            peer->benchmark->check_done();
+        }
+    }
+    g_free(line);
+
+    read_next_line(peer);
+}
+
+void read_next_line(Peer* peer)
+{
+    peer->reading = true;
+    g_data_input_stream_read_line_async(peer->output, G_PRIORITY_DEFAULT, nullptr, on_peer_line, peer);
+}
+
+gboolean on_benchmark_timeout(gpointer user_data)
+{
+    gst_printerr("Call setup benchmark: no call after %u ms\n", BENCHMARK_TIMEOUT_MS);
+    g_main_loop_quit(static_cast<GMainLoop*>(user_data));
+    return G_SOURCE_CONTINUE;          // removed once the loop returns
+}
+
+gboolean on_peer_timeout(gpointer user_data)
+{
+    g_main_loop_quit(static_cast<GMainLoop*>(user_data));
+    return G_SOURCE_CONTINUE;
+}
+
+} // namespace
+
+int run_call_setup_benchmark(const char* program, int threshold_ms)
+{
+    const std::string session_id = "call-setup-benchmark-" + xg::newGuid().str();
+    gst_print("Call setup benchmark: two peers over loopback signaling, threshold %d ms\n", threshold_ms);
+
+    Benchmark benchmark;
+    benchmark.loop = g_main_loop_new(nullptr, false);
+
+    bool ok = true;
+    for (int i = 0; i < PEERS; ++i) {
+        auto& peer = benchmark.peers[i];
+        peer.benchmark = &benchmark;
+        peer.number = i + 1;
+
+        GError* error = nullptr;
+        peer.process = g_subprocess_new(G_SUBPROCESS_FLAGS_STDOUT_PIPE, &error,
+            program, "--call-setup-peer", session_id.c_str(), nullptr);
+        if (!peer.process) {
+            gst_printerr("Failed to start peer %d: %s\n", peer.number, error->message);
+            g_error_free(error);
+            peer.finished = true;
+            ok = false;
+            continue;
+        }
+        peer.output = g_data_input_stream_new(g_subprocess_get_stdout_pipe(peer.process));
+        read_next_line(&peer);
+    }
+
+    if (ok) {
+        auto timeout = g_timeout_add(BENCHMARK_TIMEOUT_MS, on_benchmark_timeout, benchmark.loop);
+        g_main_loop_run(benchmark.loop);
+        g_source_remove(timeout);
+    }
+
+    for (auto& peer : benchmark.peers) {
+        if (!peer.process)
+            continue;
+        g_subprocess_force_exit(peer.process);
+        g_subprocess_wait(peer.process, nullptr, nullptr);
+
+        // The pipe is closed now; let the pending read see the end of it.
+        while (peer.reading)
+            g_main_context_iteration(nullptr, true);
+
+        g_clear_object(&peer.output);
+        g_clear_object(&peer.process);
+    }
+    g_main_loop_unref(benchmark.loop);
+
+    gst_print("\n%-22s", "milestone, ms");
+    for (const auto& peer : benchmark.peers)
+        gst_print("  peer %d", peer.number);
+    gst_print("\n");
+    for (auto milestone : MILESTONES) {
+        gst_print("%-22s", milestone);
+        for (const auto& peer : benchmark.peers) {
+            auto it = peer.milestones.find(milestone);
+            if (it != peer.milestones.end())
+                gst_print("  %6lld", it->second);
+            else
+                gst_print("  %6s", "-");
+        }
+        gst_print("\n");
+    }
+
+    for (const auto& peer : benchmark.peers) {
+        auto it = peer.milestones.find(FINAL_MILESTONE);
+        if (it == peer.milestones.end()) {
+            gst_printerr("Peer %d did not decode a frame\n", peer.number);
+            ok = false;
+        } else if (it->second > threshold_ms) {
+            gst_printerr("Peer %d decoded its first frame after %lld ms, over %d ms\n",
+                peer.number, it->second, threshold_ms);
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
+
+int run_call_setup_peer(const char* session_id)
+{
+    // The milestones go to a pipe, where they would otherwise wait for a full buffer.
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    Settings settings;
+    settings.video_launch_line = "videotestsrc is-live=true";
+    settings.audio_launch_line = "audiotestsrc is-live=true";
+    settings.session_id = session_id;
+    settings.signaling_transport = SignalingTransport::Loopback;
+    settings.warm_standby = false;
+    settings.headless = true;
+
+    auto loop = g_main_loop_new(nullptr, false);
+    BenchmarkPeer peer(loop);
+
+    const bool ok = start_sendrecv(0, &peer, std::move(settings));
+    if (ok) {
+        auto timeout = g_timeout_add(PEER_TIMEOUT_MS, on_peer_timeout, loop);
+        g_main_loop_run(loop);
+        g_source_remove(timeout);
+    }
+
+    shutdown_sendrecv();
+    g_main_loop_unref(loop);
+    return ok ? 0 : 1;
+}
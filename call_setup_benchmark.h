@@ -0,0 +1,22 @@
+#pragma once
+
+/*
+ * Call setup benchmark: two instances of the program call each other over
+ * loopback signaling, sending videotestsrc and audiotestsrc and rendering
+ * nothing, so that the result depends on neither the capture devices nor
+ * the public relay.
+ *
+ * The benchmark spawns both peers as child processes (the media engine is
+ * one per process) and collects the "Call setup:" milestones they print.
+ * Each peer measures from the moment it started signaling.
+ */
+
+enum { CALL_SETUP_THRESHOLD_MS_DEFAULT = 5000 };
+
+// Runs a call between two peers and prints the milestones of both. Returns
+// the process exit code: non-zero if a peer did not decode a frame within
+// threshold_ms. 'program' is the path this program was started with.
+int run_call_setup_benchmark(const char* program, int threshold_ms);
+
+// One side of the benchmark call, in a child process.
+int run_call_setup_peer(const char* session_id);
@@ -66,6 +66,10 @@ if(NOT HAVE_GSTREAMER AND WIN32)
     NAMES gobject-2.0
     PATHS ${env_paths}
     PATH_SUFFIXES "lib")
+  find_library(GSTREAMER_gio_LIBRARY
+    NAMES gio-2.0
+    PATHS ${env_paths}
+    PATH_SUFFIXES "lib")
 
   find_library(GSTREAMER_json_LIBRARY
     NAMES json-glib-1.0
@@ -113,6 +117,7 @@ if(NOT HAVE_GSTREAMER AND WIN32)
       AND GSTREAMER_riff_LIBRARY
       AND GSTREAMER_glib_LIBRARY
       AND GSTREAMER_gobject_LIBRARY
+      AND GSTREAMER_gio_LIBRARY
       AND GSTREAMER_json_LIBRARY
       AND GSTREAMER_sdp_LIBRARY
       AND GSTREAMER_webrtc_LIBRARY
@@ -133,6 +138,7 @@ if(NOT HAVE_GSTREAMER AND WIN32)
       ${GSTREAMER_pbutils_LIBRARY}
       ${GSTREAMER_glib_LIBRARY}
       ${GSTREAMER_gobject_LIBRARY}
+      ${GSTREAMER_gio_LIBRARY}
       ${GSTREAMER_json_LIBRARY}
       ${GSTREAMER_sdp_LIBRARY}
       ${GSTREAMER_webrtc_LIBRARY}
@@ -0,0 +1,197 @@
+#include "codec_registry.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+namespace {
+
+bool has_factory(const char* name)
+{
+    auto factory = gst_element_factory_find(name);
+    if (!factory)
+        return false;
+    gst_object_unref(factory);
+    return true;
+}
+
+// Rate control follows the bandwidth estimate with little buffering, and
+// keyframes come on request: the caller sets the bitrate and a long
+// keyframe distance through the properties named in VideoEncoder.
+std::vector<VideoCodec> make_video_codecs()
+{
+    std::vector<VideoCodec> codecs;
+
+    // https://developer.ridgerun.com/wiki/index.php/GstKinesisWebRTC/Getting_Started/C_Example_Application
+    codecs.push_back({ "VP8", 96, "",
+        { { ElementSpec("vp8enc")
+                .set("error-resilient", "partitions")
+                .set("deadline", "1")
+                .set("end-usage", "cbr")
+                .set("buffer-size", "1000")
+                .set("buffer-initial-size", "500")
+                .set("buffer-optimal-size", "600"),
+            "target-bitrate", 1, "keyframe-max-dist", nullptr } },
+        // picture-id-mode=15-bit seems to make TWCC stats behave better
+        ElementSpec("rtpvp8pay").set("picture-id-mode", "15-bit"),
+        "rtpvp8depay", nullptr, true });
+
+    codecs.push_back({ "VP9", 98, "",
+        { { ElementSpec("vp9enc")
+                .set("error-resilient", "default")
+                .set("deadline", "1")
+                .set("row-mt", "true")
+                .set("end-usage", "cbr")
+                .set("buffer-size", "1000")
+                .set("buffer-initial-size", "500")
+                .set("buffer-optimal-size", "600"),
+            "target-bitrate", 1, "keyframe-max-dist", nullptr } },
+        ElementSpec("rtpvp9pay").set("picture-id-mode", "15-bit"),
+        "rtpvp9depay", nullptr, true });
+
+    // Constrained baseline: no B-frames to wait for, and what every
+    // H.264 decoder takes.
+    codecs.push_back({ "H264", 102, ",packetization-mode=(string)1",
+        { { ElementSpec("x264enc")
+                .set("tune", "zerolatency")
+                .set("speed-preset", "ultrafast"),
+            "bitrate", 1000, "key-int-max", "video/x-h264,profile=constrained-baseline" },
+          { ElementSpec("openh264enc")
+                .set("usage-type", "camera")
+                .set("rate-control", "bitrate")
+                .set("complexity", "low"),
+            "bitrate", 1, "gop-size", nullptr } },
+        // SPS and PPS with every keyframe, so that a requested one decodes
+        ElementSpec("rtph264pay")
+            .set("config-interval", "-1")
+            .set("aggregate-mode", "zero-latency"),
+        "rtph264depay", "h264parse", false });
+
+    codecs.push_back({ "AV1", 104, "",
+        { { ElementSpec("svtav1enc")
+                .set("preset", "10"),
+            "target-bitrate", 1000, "intra-period-length", nullptr } },
+        ElementSpec("rtpav1pay"),
+        "rtpav1depay", "av1parse", false });
+
+    return codecs;
+}
+
+} // namespace
+
+const std::vector<VideoCodec>& video_codecs()
+{
+    static const std::vector<VideoCodec> codecs = make_video_codecs();
+    return codecs;
+}
+
+const VideoCodec* find_video_codec(const char* encoding_name)
+{
+    if (!encoding_name)
+        return nullptr;
+    for (const auto& codec : video_codecs()) {
+        if (!g_ascii_strcasecmp(codec.encoding_name, encoding_name))
+            return &codec;
+    }
+    return nullptr;
+}
+
+const VideoEncoder* available_encoder(const VideoCodec& codec)
+{
+    for (const auto& encoder : codec.encoders) {
+        if (has_factory(encoder.spec.factory.c_str()))
+            return &encoder;
+    }
+    return nullptr;
+}
+
+bool is_available(const VideoCodec& codec)
+{
+    return available_encoder(codec)
+        && has_factory(codec.payloader.factory.c_str())
+        && has_factory(codec.depayloader);
+}
+
+std::vector<const VideoCodec*> preferred_video_codecs(const std::string& preference)
+{
+    std::vector<const VideoCodec*> result;
+
+    auto names = g_strsplit_set(preference.c_str(), ", ", -1);
+    for (auto name = names; *name; ++name) {
+        if (!**name)
+            continue;
+        auto codec = find_video_codec(*name);
+        if (!codec) {
+            gst_printerr("Unknown video codec '%s' in the preference list, ignoring\n", *name);
+            continue;
+        }
+        if (std::find(result.begin(), result.end(), codec) == result.end() && is_available(*codec))
+            result.push_back(codec);
+    }
+    g_strfreev(names);
+
+    if (result.empty())
+        result.push_back(find_video_codec("VP8"));
+    return result;
+}
+
+const VideoCodec* choose_offered_video_codec(const GstSDPMessage* sdp,
+    const std::vector<const VideoCodec*>& preferred,
+    const std::function<bool(const VideoCodec&)>& can_send, int& payload_type)
+{
+    std::map<const VideoCodec*, int> offered;
+    std::vector<const VideoCodec*> in_order;
+    for (guint i = 0; i < gst_sdp_message_medias_len(sdp); i++) {
+        auto media = gst_sdp_message_get_media(sdp, i);
+        if (g_strcmp0(gst_sdp_media_get_media(media), "video"))
+            continue;
+        for (guint j = 0; j < gst_sdp_media_formats_len(media); j++) {
+            const int pt = atoi(gst_sdp_media_get_format(media, j));
+            auto caps = gst_sdp_media_get_caps_from_media(media, pt);
+            if (!caps)
+                continue;
+            auto codec = find_video_codec(gst_structure_get_string(gst_caps_get_structure(caps, 0), "encoding-name"));
+            gst_caps_unref(caps);
+            if (codec && offered.emplace(codec, pt).second)
+                in_order.push_back(codec);
+        }
+        break;
+    }
+
+    for (auto codec : preferred) {
+        if (auto it = offered.find(codec); it != offered.end()) {
+            payload_type = it->second;
+            return codec;
+        }
+    }
+    for (auto codec : in_order) {
+        if (can_send(*codec)) {
+            payload_type = offered[codec];
+            return codec;
+        }
+    }
+    return nullptr;
+}
+
+bool is_video_depayloader(const char* factory_name)
+{
+    return std::any_of(video_codecs().begin(), video_codecs().end(),
+        [factory_name](const VideoCodec& codec) { return !strcmp(codec.depayloader, factory_name); });
+}
+
+std::string rtp_caps(const VideoCodec& codec, int payload_type)
+{
+    return std::string("application/x-rtp,media=video,encoding-name=") + codec.encoding_name
+        + ",payload=" + std::to_string(payload_type) + ",clock-rate=90000" + codec.rtp_caps_extra;
+}
+
+const char* muxer_factory(const VideoCodec& codec)
+{
+    return codec.webm ? "webmmux" : "matroskamux";
+}
+
+const char* recording_extension(const VideoCodec& codec)
+{
+    return codec.webm ? ".webm" : ".mkv";
+}
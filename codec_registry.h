@@ -0,0 +1,77 @@
+#pragma once
+
+#include "pipeline_builder.h"
+
+#include <gst/sdp/sdp.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * The video codecs a call can use.
+ *
+ * Each codec lists the elements that send and record it, the RTP caps it is
+ * sent with and the container it can be recorded to. Which one is sent is a
+ * deployment choice: H.264 is the cheapest to encode on low-end machines,
+ * VP9 and AV1 keep more quality at a low bitrate, VP8 works everywhere.
+ *
+ * A codec is available when one of its encoders, its payloader and its
+ * depayloader are installed.
+ */
+
+struct VideoEncoder
+{
+    ElementSpec spec;                       // low-latency settings; named by the caller
+    const char* bitrate_property;
+    int bitrate_divisor;                    // 1 if the property is in bits/s, 1000 for kbit/s
+    const char* keyframe_distance_property; // frames between keyframes
+    const char* output_caps;                // to pin the encoder's output, or nullptr
+};
+
+struct VideoCodec
+{
+    const char* encoding_name;              // as in the SDP rtpmap, e.g. "VP8"
+    int payload_type;
+    const char* rtp_caps_extra;             // fmtp parameters, ",name=(string)value..."
+    std::vector<VideoEncoder> encoders;     // in order of preference
+    ElementSpec payloader;
+    const char* depayloader;
+    const char* parser;                     // between depayloader and muxer, or nullptr
+    bool webm;                              // webmmux takes it; matroskamux otherwise
+};
+
+const std::vector<VideoCodec>& video_codecs();
+
+// By encoding name, case insensitive; nullptr if unknown.
+const VideoCodec* find_video_codec(const char* encoding_name);
+
+// The first installed encoder of the codec, or nullptr.
+const VideoEncoder* available_encoder(const VideoCodec& codec);
+
+bool is_available(const VideoCodec& codec);
+
+// The available codecs of a comma separated preference list ("H264, VP8"),
+// in its order; VP8 if none of them is.
+std::vector<const VideoCodec*> preferred_video_codecs(const std::string& preference);
+
+// The video codec to answer an SDP offer with, and its payload type in the
+// offer: the first of 'preferred' that the offer carries, else the first it
+// carries that can_send() takes. A peer of ours offers the codecs it can
+// send, a browser all it has. nullptr if there is none.
+const VideoCodec* choose_offered_video_codec(const GstSDPMessage* sdp,
+    const std::vector<const VideoCodec*>& preferred,
+    const std::function<bool(const VideoCodec&)>& can_send, int& payload_type);
+
+// Whether the factory is the depayloader of one of the codecs.
+bool is_video_depayloader(const char* factory_name);
+
+std::string rtp_caps(const VideoCodec& codec, int payload_type);
+
+inline std::string rtp_caps(const VideoCodec& codec)
+{
+    return rtp_caps(codec, codec.payload_type);
+}
+
+const char* muxer_factory(const VideoCodec& codec);
+const char* recording_extension(const VideoCodec& codec);
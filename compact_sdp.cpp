@@ -0,0 +1,173 @@
+#include "compact_sdp.h"
+
+#include "base64url.h"
+#include "makeguard.h"
+
+#include <gio/gio.h>
+
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+namespace {
+
+// Allowed at the session level, and applied by webrtcbin to every media
+// section that has no value of its own. ICE credentials go first, as a pair.
+const char* const hoistable_attributes[] = {
+    "a=ice-ufrag:",
+    "a=ice-pwd:",
+    "a=ice-options:",
+    "a=fingerprint:",
+};
+
+// Inflating more than that is not an SDP anymore.
+const size_t MAX_SDP_SIZE = 64 * 1024;
+
+std::vector<std::string> split_lines(const std::string& sdp)
+{
+    std::vector<std::string> lines;
+    size_t begin = 0;
+    while (begin < sdp.size()) {
+        auto end = sdp.find('\n', begin);
+        if (end == std::string::npos)
+            end = sdp.size();
+        auto line = sdp.substr(begin, end - begin);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            lines.push_back(std::move(line));
+        begin = end + 1;
+    }
+    return lines;
+}
+
+std::string strip_redundant_attributes(const std::string& sdp)
+{
+    auto lines = split_lines(sdp);
+
+    // Section boundaries: [0] is the session, then one per m= line.
+    std::vector<size_t> sections{ 0 };
+    for (size_t i = 0; i < lines.size(); ++i)
+        if (lines[i].compare(0, 2, "m=") == 0)
+            sections.push_back(i);
+    sections.push_back(lines.size());
+
+    const size_t media_count = sections.size() - 2;
+    if (media_count < 2)
+        return sdp;
+
+    struct Hoist
+    {
+        const std::string* value = nullptr;
+        std::vector<size_t> occurrences;
+    };
+    Hoist hoists[std::size(hoistable_attributes)];
+
+    for (size_t h = 0; h < std::size(hoistable_attributes); ++h) {
+        const auto prefix = hoistable_attributes[h];
+        const size_t prefix_len = strlen(prefix);
+        auto has_prefix = [&](size_t i) { return lines[i].compare(0, prefix_len, prefix) == 0; };
+
+        bool in_session = false;
+        for (size_t i = sections[0]; i < sections[1]; ++i)
+            in_session = in_session || has_prefix(i);
+        if (in_session)
+            continue;
+
+        // Exactly one occurrence per media section, with one and the same value.
+        const std::string* value = nullptr;
+        std::vector<size_t> occurrences;
+        bool same = true;
+        for (size_t m = 1; same && m <= media_count; ++m) {
+            size_t found = 0;
+            for (size_t i = sections[m]; i < sections[m + 1]; ++i) {
+                if (!has_prefix(i))
+                    continue;
+                if (++found > 1 || (value && lines[i] != *value)) {
+                    same = false;
+                    break;
+                }
+                value = &lines[i];
+                occurrences.push_back(i);
+            }
+            same = same && found == 1;
+        }
+        if (same)
+            hoists[h] = { value, std::move(occurrences) };
+    }
+
+    // webrtcbin takes ICE credentials from the media section only if both are there.
+    if (!hoists[0].value != !hoists[1].value)
+        hoists[0] = hoists[1] = {};
+
+    std::vector<std::string> hoisted;
+    std::vector<bool> dropped(lines.size());
+    for (const auto& hoist : hoists) {
+        if (!hoist.value)
+            continue;
+        hoisted.push_back(*hoist.value);
+        for (auto i : hoist.occurrences)
+            dropped[i] = true;
+    }
+
+    std::string result;
+    result.reserve(sdp.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (i == sections[1])
+            for (const auto& line : hoisted)
+                result.append(line).append("\r\n");
+        if (!dropped[i])
+            result.append(lines[i]).append("\r\n");
+    }
+    return result;
+}
+
+bool convert(GConverter* converter, std::string_view input, std::string& output, size_t limit)
+{
+    output.clear();
+
+    char buffer[4096];
+    for (;;) {
+        gsize bytes_read = 0;
+        gsize bytes_written = 0;
+        GError* error = nullptr;
+        const auto result = g_converter_convert(converter, input.data(), input.size(),
+            buffer, sizeof(buffer), G_CONVERTER_INPUT_AT_END, &bytes_read, &bytes_written, &error);
+        if (result == G_CONVERTER_ERROR) {
+            g_error_free(error);
+            return false;
+        }
+
+        input.remove_prefix(bytes_read);
+        output.append(buffer, bytes_written);
+        if (output.size() > limit)
+            return false;
+
+        if (result == G_CONVERTER_FINISHED)
+            return true;
+    }
+}
+
+} // namespace
+
+std::string compact_sdp_encode(const std::string& sdp)
+{
+    auto compressor = MakeGuard(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, 9), g_object_unref);
+
+    std::string deflated;
+    if (!convert(G_CONVERTER(compressor.get()), strip_redundant_attributes(sdp), deflated, MAX_SDP_SIZE))
+        return {};
+
+    return base64url_encode(deflated);
+}
+
+bool compact_sdp_decode(std::string_view encoded, std::string& sdp)
+{
+    std::string deflated;
+    if (!base64url_decode(encoded, deflated))
+        return false;
+
+    auto decompressor = MakeGuard(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW), g_object_unref);
+
+    return convert(G_CONVERTER(decompressor.get()), deflated, sdp, MAX_SDP_SIZE);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+/*
+ * Compact form of an SDP blob for signaling: attributes repeated verbatim in
+ * every media section are moved to the session level, then the text is
+ * raw-deflated and base64url encoded.
+ */
+
+// Capability token of peers that accept compact SDP.
+#define COMPACT_SDP_CAPABILITY "zsdp"
+
+// Returns an empty string on failure.
+std::string compact_sdp_encode(const std::string& sdp);
+
+bool compact_sdp_decode(std::string_view encoded, std::string& sdp);
@@ -0,0 +1,191 @@
+#include "dtls_certificate.h"
+
+#include "makeguard.h"
+
+#include <QDebug>
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+namespace {
+
+const long VALIDITY_DAYS = 30;
+const int RENEW_DAYS_BEFORE_EXPIRY = 7;
+
+std::string bio_to_string(BIO* bio)
+{
+    char* data = nullptr;
+    const long size = BIO_get_mem_data(bio, &data);
+    return size > 0 ? std::string(data, size) : std::string();
+}
+
+std::string generate_certificate()
+{
+    auto ctx = MakeGuard(EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr), EVP_PKEY_CTX_free);
+    EVP_PKEY* raw_key = nullptr;
+    if (!ctx
+        || EVP_PKEY_keygen_init(ctx.get()) <= 0
+        || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), NID_X9_62_prime256v1) <= 0
+        || EVP_PKEY_keygen(ctx.get(), &raw_key) <= 0)
+        return {};
+    auto key = MakeGuard(raw_key, EVP_PKEY_free);
+
+    auto cert = MakeGuard(X509_new(), X509_free);
+    if (!cert)
+        return {};
+
+    unsigned char serial[8];
+    RAND_bytes(serial, sizeof(serial));
+    serial[0] &= 0x7f;
+    auto serial_bn = MakeGuard(BN_bin2bn(serial, sizeof(serial), nullptr), BN_free);
+
+    X509_set_version(cert.get(), 2);
+    BN_to_ASN1_INTEGER(serial_bn.get(), X509_get_serialNumber(cert.get()));
+    // Backdated a day, against peers whose clock runs behind
+    X509_gmtime_adj(X509_getm_notBefore(cert.get()), -24 * 3600);
+    X509_gmtime_adj(X509_getm_notAfter(cert.get()), VALIDITY_DAYS * 24 * 3600);
+    X509_set_pubkey(cert.get(), key.get());
+
+    auto name = X509_get_subject_name(cert.get());
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char*>("webrtc-ui"), -1, -1, 0);
+    X509_set_issuer_name(cert.get(), name);
+
+    if (!X509_sign(cert.get(), key.get(), EVP_sha256()))
+        return {};
+
+    auto bio = MakeGuard(BIO_new(BIO_s_mem()), BIO_free);
+    if (!PEM_write_bio_X509(bio.get(), cert.get())
+        || !PEM_write_bio_PrivateKey(bio.get(), key.get(), nullptr, nullptr, 0, nullptr, nullptr))
+        return {};
+
+    return bio_to_string(bio.get());
+}
+
+// Whether the PEM holds a certificate and key that stay valid for a while.
+bool is_usable(const std::string& pem)
+{
+    auto bio = MakeGuard(BIO_new_mem_buf(pem.data(), static_cast<int>(pem.size())), BIO_free);
+    auto cert = MakeGuard(PEM_read_bio_X509(bio.get(), nullptr, nullptr, nullptr), X509_free);
+    auto key = MakeGuard(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr), EVP_PKEY_free);
+    if (!cert || !key || X509_check_private_key(cert.get(), key.get()) != 1)
+        return false;
+
+    int days = 0, seconds = 0;
+    if (!ASN1_TIME_diff(&days, &seconds, nullptr, X509_get0_notAfter(cert.get())))
+        return false;
+    return days >= RENEW_DAYS_BEFORE_EXPIRY;
+}
+
+std::string read_file(const std::filesystem::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// Replaces the file in one step, readable by the owner only.
+bool write_file(const std::filesystem::path& path, const std::string& contents)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    auto temp = path;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        std::filesystem::permissions(temp,
+            std::filesystem::perms::owner_read | std::filesystem::perms::owner_write, ec);
+        out << contents;
+        if (!out.flush())
+            return false;
+    }
+
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+    return true;
+}
+
+class DtlsCertificateCache
+{
+public:
+    ~DtlsCertificateCache()
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+
+    void prepare(const std::filesystem::path& pem_path)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (thread.joinable() || ready)
+            return;
+
+        thread = std::thread([this, pem_path] {
+            const auto started = std::chrono::steady_clock::now();
+
+            auto result = read_file(pem_path);
+            const bool stored = !result.empty() && is_usable(result);
+            if (!stored) {
+                result = generate_certificate();
+                if (result.empty())
+                    qWarning() << "Cannot generate a DTLS certificate";
+                else if (!write_file(pem_path, result))
+                    qWarning() << "Cannot store the DTLS certificate";
+            }
+
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started).count();
+            qDebug() << "DTLS certificate" << (stored ? "loaded" : "generated") << "in" << elapsed << "ms";
+
+            std::lock_guard<std::mutex> lock(mtx);
+            pem = std::move(result);
+            ready = true;
+            cv.notify_all();
+        });
+    }
+
+    std::string get(std::chrono::milliseconds wait)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait_for(lock, wait, [this] { return ready; });
+        return pem;
+    }
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread thread;
+    bool ready = false;
+    std::string pem;
+};
+
+DtlsCertificateCache dtls_certificate_cache;
+
+} // namespace
+
+void prepare_dtls_certificate(const std::filesystem::path& pem_path)
+{
+    dtls_certificate_cache.prepare(pem_path);
+}
+
+std::string get_dtls_certificate(std::chrono::milliseconds wait)
+{
+    return dtls_certificate_cache.get(wait);
+}
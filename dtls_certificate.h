@@ -0,0 +1,20 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+/*
+ * A self-signed ECDSA P-256 certificate for the DTLS handshake, kept in a PEM
+ * file (certificate followed by its key) so that calls do not wait for the
+ * dtls plugin to generate one. The file is rewritten with a new certificate
+ * when the stored one gets close to expiry.
+ */
+
+// Loads or generates the certificate on a background thread; only the first
+// call does anything.
+void prepare_dtls_certificate(const std::filesystem::path& pem_path);
+
+// The PEM, waiting up to 'wait' for prepare_dtls_certificate() to finish.
+// Empty if there is none, in which case the dtls plugin uses its own.
+std::string get_dtls_certificate(std::chrono::milliseconds wait);
@@ -0,0 +1,295 @@
+#include "encoder_tuning.h"
+
+#include "pipeline_builder.h"
+
+#include <algorithm>
+
+namespace {
+
+const int BENCHMARK_FRAMES = 300;
+
+// Most frames are in the encoder for a few milliseconds; more than this
+// many in flight means the src side has stopped seeing them.
+const size_t MAX_IN_FLIGHT = 300;
+
+int largest_power_of_two(int n)
+{
+    int result = 1;
+    while (result * 2 <= n)
+        result *= 2;
+    return result;
+}
+
+int log2_of(int power_of_two)
+{
+    int result = 0;
+    while (power_of_two > 1) {
+        power_of_two /= 2;
+        ++result;
+    }
+    return result;
+}
+
+GstClockTime buffer_pts(GstPadProbeInfo* info)
+{
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    return buffer ? GST_BUFFER_PTS(buffer) : GST_CLOCK_TIME_NONE;
+}
+
+bool benchmark_one(int width, int height, const VideoEncoderTuning& tuning,
+    EncodeLatencyMeter::Summary& result)
+{
+    std::string error;
+    auto caps = "video/x-raw,format=I420,width=" + std::to_string(width) + ",height="
+        + std::to_string(height) + ",framerate=30/1";
+
+    GstElement* elements[] = {
+        // Scrolling, so that every frame has something to encode.
+        build_element(ElementSpec("videotestsrc")
+            .set("num-buffers", std::to_string(BENCHMARK_FRAMES))
+            .set("horizontal-speed", "4"), error),
+        build_element(ElementSpec("capsfilter").set("caps", caps), error),
+        build_element(ElementSpec("vp8enc", "videoenc")
+            .set("error-resilient", "partitions")
+            .set("deadline", "1")
+            .set("end-usage", "cbr")
+            .set("target-bitrate", std::to_string(width * height * 2)), error),
+        build_element(ElementSpec("fakesink").set("sync", "false"), error),
+    };
+
+    auto pipeline = gst_pipeline_new("encoder-benchmark");
+    bool ok = true;
+    for (auto element : elements) {
+        if (element)
+            gst_bin_add(GST_BIN(pipeline), element);
+        else
+            ok = false;
+    }
+    if (!ok || !gst_element_link_many(elements[0], elements[1], elements[2], elements[3], nullptr)) {
+        gst_printerr("Cannot build the benchmark pipeline: %s\n", error.empty() ? "link failed" : error.c_str());
+        gst_object_unref(pipeline);
+        return false;
+    }
+
+    EncodeLatencyMeter meter;
+    meter.attach(elements[2]);
+    apply_encoder_tuning(elements[2], tuning);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    auto bus = gst_element_get_bus(pipeline);
+    auto msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg && !ok) {
+        GError* err = nullptr;
+        gst_message_parse_error(msg, &err, nullptr);
+        gst_printerr("Benchmark failed: %s\n", err->message);
+        g_clear_error(&err);
+    }
+    if (msg)
+        gst_message_unref(msg);
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    result = meter.summary();
+    return ok;
+}
+
+} // namespace
+
+VideoEncoderTuning auto_encoder_tuning(unsigned cores, int width, int height)
+{
+    const long long pixels = static_cast<long long>(width) * height;
+
+    // libvpx shares the rows of a frame between threads; on small frames the
+    // synchronisation costs more than it saves. One core is left for capture
+    // and decoding.
+    int max_threads = 1;
+    if (pixels >= 1920 * 1080)
+        max_threads = 8;
+    else if (pixels >= 1280 * 720)
+        max_threads = 4;
+    else if (pixels > 640 * 480)
+        max_threads = 2;
+
+    VideoEncoderTuning tuning;
+    tuning.threads = std::max(1, std::min(max_threads, static_cast<int>(cores) - 1));
+    // Token partitions let the receiving decoder use as many threads.
+    tuning.token_partitions = std::min(8, largest_power_of_two(tuning.threads));
+    if (cores <= 2)
+        tuning.cpu_used = -12;
+    else if (pixels >= 1920 * 1080)
+        tuning.cpu_used = -8;
+    else
+        tuning.cpu_used = -6;
+    return tuning;
+}
+
+VideoEncoderTuning resolve_encoder_tuning(unsigned cores, int width, int height,
+    const VideoEncoderOverrides& overrides)
+{
+    auto tuning = auto_encoder_tuning(cores, width, height);
+    if (overrides.threads > 0)
+        tuning.threads = overrides.threads;
+    if (overrides.token_partitions > 0)
+        tuning.token_partitions = std::min(8, largest_power_of_two(overrides.token_partitions));
+    if (overrides.speed > 0)
+        tuning.cpu_used = -std::min(16, overrides.speed);
+    return tuning;
+}
+
+void apply_encoder_tuning(GstElement* encoder, const VideoEncoderTuning& tuning)
+{
+    auto find = [encoder](const char* property) {
+        return g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), property);
+    };
+
+    if (find("threads"))
+        g_object_set(encoder, "threads", tuning.threads, nullptr);
+    if (find("token-partitions"))
+        g_object_set(encoder, "token-partitions", log2_of(tuning.token_partitions), nullptr); // enum: 1 << value partitions
+
+    // Negative speeds are libvpx's; other encoders' cpu-used is a preset.
+    auto cpu_used = find("cpu-used");
+    if (cpu_used && G_PARAM_SPEC_VALUE_TYPE(cpu_used) == G_TYPE_INT && G_PARAM_SPEC_INT(cpu_used)->minimum < 0)
+        g_object_set(encoder, "cpu-used", tuning.cpu_used, nullptr);
+}
+
+std::string describe_encoder_tuning(const VideoEncoderTuning& tuning)
+{
+    return "threads=" + std::to_string(tuning.threads)
+        + " token-partitions=" + std::to_string(tuning.token_partitions)
+        + " cpu-used=" + std::to_string(tuning.cpu_used);
+}
+
+void EncodeLatencyMeter::attach(GstElement* encoder)
+{
+    auto sinkpad = gst_element_get_static_pad(encoder, "sink");
+    gst_pad_add_probe(sinkpad, GST_PAD_PROBE_TYPE_BUFFER, input_probe, this, nullptr);
+    gst_object_unref(sinkpad);
+
+    auto srcpad = gst_element_get_static_pad(encoder, "src");
+    gst_pad_add_probe(srcpad, GST_PAD_PROBE_TYPE_BUFFER, output_probe, this, nullptr);
+    gst_object_unref(srcpad);
+}
+
+GstPadProbeReturn EncodeLatencyMeter::input_probe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer user_data)
+{
+    const auto pts = buffer_pts(info);
+    if (!GST_CLOCK_TIME_IS_VALID(pts))
+        return GST_PAD_PROBE_OK;
+
+    auto self = static_cast<EncodeLatencyMeter*>(user_data);
+    std::lock_guard<std::mutex> lock(self->mtx);
+    self->in_flight.emplace_back(pts, Clock::now());
+    if (self->in_flight.size() > MAX_IN_FLIGHT)
+        self->in_flight.pop_front();
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn EncodeLatencyMeter::output_probe(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer user_data)
+{
+    const auto pts = buffer_pts(info);
+    if (!GST_CLOCK_TIME_IS_VALID(pts))
+        return GST_PAD_PROBE_OK;
+
+    const auto now = Clock::now();
+    auto self = static_cast<EncodeLatencyMeter*>(user_data);
+    std::lock_guard<std::mutex> lock(self->mtx);
+
+    // Earlier frames never came out: dropped by rate control.
+    while (!self->in_flight.empty() && self->in_flight.front().first < pts)
+        self->in_flight.pop_front();
+    if (self->in_flight.empty() || self->in_flight.front().first != pts)
+        return GST_PAD_PROBE_OK;
+
+    const double ms = std::chrono::duration<double, std::milli>(now - self->in_flight.front().second).count();
+    self->in_flight.pop_front();
+
+    if (self->samples.size() < MAX_SAMPLES)
+        self->samples.push_back(ms);
+    else
+        self->samples[self->next_sample] = ms;
+    self->next_sample = (self->next_sample + 1) % MAX_SAMPLES;
+
+    if (!self->frames)
+        self->first_output = now;
+    self->last_output = now;
+    ++self->frames;
+    self->total_ms += ms;
+    self->max_ms = std::max(self->max_ms, ms);
+    return GST_PAD_PROBE_OK;
+}
+
+EncodeLatencyMeter::Summary EncodeLatencyMeter::summary() const
+{
+    std::vector<double> recent;
+    Summary result;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!frames)
+            return result;
+        result.frames = frames;
+        result.average_ms = total_ms / frames;
+        result.max_ms = max_ms;
+        const double seconds = std::chrono::duration<double>(last_output - first_output).count();
+        if (frames > 1 && seconds > 0)
+            result.fps = (frames - 1) / seconds;
+        recent = samples;
+    }
+
+    const auto p95 = recent.begin() + (recent.size() * 95) / 100;
+    std::nth_element(recent.begin(), p95, recent.end());
+    result.p95_ms = p95 != recent.end() ? *p95 : result.max_ms;
+    return result;
+}
+
+void EncodeLatencyMeter::reset()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    in_flight.clear();
+    samples.clear();
+    next_sample = 0;
+    frames = 0;
+    total_ms = 0;
+    max_ms = 0;
+    first_output = {};
+    last_output = {};
+}
+
+int run_encoder_benchmark()
+{
+    const unsigned cores = g_get_num_processors();
+    gst_print("VP8 encoder benchmark: %d frames of videotestsrc, %u cores\n", BENCHMARK_FRAMES, cores);
+
+    const std::pair<int, int> sizes[] = { { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+
+    bool ok = true;
+    for (const auto& size : sizes) {
+        VideoEncoderTuning single;
+        VideoEncoderTuning all_cores;
+        all_cores.threads = static_cast<int>(cores);
+        all_cores.token_partitions = std::min(8, largest_power_of_two(all_cores.threads));
+
+        const std::pair<const char*, VideoEncoderTuning> configs[] = {
+            { "single thread", single },
+            { "auto", auto_encoder_tuning(cores, size.first, size.second) },
+            { "all cores", all_cores },
+        };
+
+        for (const auto& config : configs) {
+            EncodeLatencyMeter::Summary summary;
+            if (!benchmark_one(size.first, size.second, config.second, summary)) {
+                ok = false;
+                continue;
+            }
+            gst_print("%dx%d %-13s %s: %.1f fps, latency %.2f ms average, %.2f ms p95, %.2f ms max\n",
+                size.first, size.second, config.first, describe_encoder_tuning(config.second).c_str(),
+                summary.fps, summary.average_ms, summary.p95_ms, summary.max_ms);
+        }
+    }
+    return ok ? 0 : 1;
+}
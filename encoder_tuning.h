@@ -0,0 +1,92 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Parallelism of the VP8 encoder.
+ *
+ * vp8enc encodes on a single thread with one token partition by default,
+ * which caps 720p and above at what one core manages. The settings here are
+ * picked from the number of cores and the frame size, the way libvpx based
+ * WebRTC stacks do, unless the user overrides them.
+ */
+
+struct VideoEncoderTuning
+{
+    int threads = 1;
+    int token_partitions = 1;   // 1, 2, 4 or 8
+    int cpu_used = -6;          // negative: realtime speed that libvpx may adapt
+};
+
+// Overrides of zero leave the automatic choice in place.
+struct VideoEncoderOverrides
+{
+    int threads = 0;
+    int token_partitions = 0;
+    int speed = 0;              // 1..16, applied as cpu-used -speed
+};
+
+VideoEncoderTuning auto_encoder_tuning(unsigned cores, int width, int height);
+
+VideoEncoderTuning resolve_encoder_tuning(unsigned cores, int width, int height,
+    const VideoEncoderOverrides& overrides);
+
+// Applies the tuning to an encoder that has not started encoding yet, as far
+// as it has the properties; all of it applies to vp8enc.
+void apply_encoder_tuning(GstElement* encoder, const VideoEncoderTuning& tuning);
+
+std::string describe_encoder_tuning(const VideoEncoderTuning& tuning);
+
+/*
+ * Time each frame spends in the encoder, matched by PTS between the probes
+ * on its sink and src pads; frames dropped by rate control are skipped.
+ * The probes run on different streaming threads.
+ */
+class EncodeLatencyMeter
+{
+public:
+    struct Summary
+    {
+        unsigned frames = 0;
+        double fps = 0;             // encoded frames per second of wall clock time
+        double average_ms = 0;
+        double p95_ms = 0;
+        double max_ms = 0;
+    };
+
+    // Installs the probes on the encoder's pads; the meter must outlive them.
+    void attach(GstElement* encoder);
+
+    // Probe callbacks, with the meter as user data.
+    static GstPadProbeReturn input_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+    static GstPadProbeReturn output_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+
+    Summary summary() const;
+    void reset();
+
+private:
+    enum { MAX_SAMPLES = 1000 };    // the recent ones, for the percentile
+
+    typedef std::chrono::steady_clock Clock;
+
+    mutable std::mutex mtx;
+    std::deque<std::pair<GstClockTime, Clock::time_point>> in_flight;
+    std::vector<double> samples;
+    size_t next_sample = 0;
+    unsigned frames = 0;
+    double total_ms = 0;
+    double max_ms = 0;
+    Clock::time_point first_output{};
+    Clock::time_point last_output{};
+};
+
+// Encodes videotestsrc at a few resolutions with the automatic and some
+// fixed configurations, printing encode fps and per-frame latency of each.
+// Returns the process exit code.
+int run_encoder_benchmark();
@@ -3,6 +3,28 @@
 #include <QString>
 
 inline const auto SETTING_SESSION_ID = QStringLiteral("sessionId");
+inline const auto SETTING_SIGNALING_TRANSPORT = QStringLiteral("signalingTransport");
+inline const auto SETTING_SIGNALING_RELAY_URL = QStringLiteral("signalingRelayUrl");
+
+inline const auto SETTING_TRICKLE_ICE = QStringLiteral("trickleIce");
+inline const auto SETTING_ICE_FLUSH_INTERVAL_MS = QStringLiteral("iceFlushIntervalMs");
+inline const auto SETTING_COMPACT_SDP = QStringLiteral("compactSdp");
+inline const auto SETTING_FAST_CALL_SETUP = QStringLiteral("fastCallSetup");
+inline const auto SETTING_WARM_STANDBY = QStringLiteral("warmStandby");
+
+inline const auto SETTING_ICE_CANDIDATES = QStringLiteral("iceCandidates");
+inline const auto SETTING_ICE_ADDRESS_FAMILY = QStringLiteral("iceAddressFamily");
+inline const auto SETTING_ICE_TCP = QStringLiteral("iceTcp");
+inline const auto SETTING_ICE_ALLOWED_NETWORKS = QStringLiteral("iceAllowedNetworks");
+inline const auto SETTING_ICE_DENIED_NETWORKS = QStringLiteral("iceDeniedNetworks");
+inline const auto ICE_DENIED_NETWORKS_DEFAULT = QStringLiteral("169.254.0.0/16, fe80::/10");
+
+inline const auto SETTING_ENCODER_THREADS = QStringLiteral("encoderThreads");
+inline const auto SETTING_ENCODER_TOKEN_PARTITIONS = QStringLiteral("encoderTokenPartitions");
+inline const auto SETTING_ENCODER_SPEED = QStringLiteral("encoderSpeed");
+inline const auto SETTING_VIDEO_CODECS = QStringLiteral("videoCodecs");
+inline const auto VIDEO_CODECS_DEFAULT = QStringLiteral("VP8, VP9, H264, AV1");
+inline const auto SETTING_TEMPORAL_LAYERS = QStringLiteral("temporalLayers");
 
 inline const auto SETTING_USE_TURN = QStringLiteral("useTURN");
 inline const auto SETTING_TURN = QStringLiteral("TURN");
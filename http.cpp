@@ -95,29 +95,19 @@ static void curl_log_result(CURL* curl) {
 #undef curl_info
 }
 
-/*
- * returns a prepared curl handle.
- *
- * Note that we always work with the same curl handle. This seems to work great,
- * and it means we don't have to clean up handles, because all we leak is just
- * that one handle, and it is going to be reused all the time anyways.
- *
- * THIS ALSO MEANS THAT THIS CODE IS NOT THREADSAFE, and propably NOT REENTRANT.
- */
-//#define MAX_HANDLES 10
-
-static CURL* curl_handle(int /*index*/) {
+static void curl_init_once() {
   static std::once_flag curl_initialised;
 
   std::call_once(curl_initialised,[] {
     curl_global_init(CURL_GLOBAL_ALL);  /* In windows, this will init the winsock stuff */ 
     atexit(curl_global_cleanup);
   });
+}
 
-  CURL* curl = curl_easy_init();
-  if (!curl)
-      return nullptr;
-
+/*
+ * applies our default options to a fresh (or freshly reset) curl handle.
+ */
+static void curl_set_defaults(CURL* curl) {
   /* === verbosity? ================================================ */
 
   curl_easy_setopt(curl, CURLOPT_VERBOSE, options.verbosity >= 1 ? 1 : 0);
@@ -165,10 +155,113 @@ static CURL* curl_handle(int /*index*/) {
 
   // https://stackoverflow.com/questions/30098087/is-libcurl-really-thread-safe
   curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-  
+}
+
+/*
+ * returns a prepared, one-shot curl handle.
+ */
+static CURL* curl_handle(int /*index*/) {
+  curl_init_once();
+
+  CURL* curl = curl_easy_init();
+  if (!curl)
+      return nullptr;
+
+  curl_set_defaults(curl);
+
   return curl;
 }
 
+/*
+ * HttpPool
+ */
+
+// Idle handles beyond this count are cleaned up instead of being kept around.
+#define MAX_IDLE_HANDLES 4
+
+HttpPool::HttpPool() {
+  curl_init_once();
+
+  share = curl_share_init();
+  if (share) {
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  }
+}
+
+HttpPool::~HttpPool() {
+  for (auto curl : idle)
+    curl_easy_cleanup(curl);
+  idle.clear();
+
+  if (share)
+    curl_share_cleanup(share);
+}
+
+void HttpPool::lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+  static_cast<HttpPool*>(userptr)->share_locks[data].lock();
+}
+
+void HttpPool::unlock(CURL*, curl_lock_data data, void* userptr) {
+  static_cast<HttpPool*>(userptr)->share_locks[data].unlock();
+}
+
+CURL* HttpPool::acquire() {
+  CURL* curl = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!idle.empty()) {
+      curl = idle.back();
+      idle.pop_back();
+    }
+  }
+
+  if (!curl && !(curl = curl_easy_init()))
+    return nullptr;
+
+  curl_set_defaults(curl);
+
+  if (share)
+    curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+  /*
+   * Keep the connection warm between signaling messages and let curl
+   * negotiate HTTP/2 over TLS so that requests can share it.
+   */
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+
+  return curl;
+}
+
+bool HttpPool::has_idle_connection() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return !idle.empty();
+}
+
+void HttpPool::release(CURL* curl) {
+  if (!curl)
+    return;
+
+  // Resets the options but keeps the connections, DNS and TLS session caches.
+  curl_easy_reset(curl);
+
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (idle.size() < MAX_IDLE_HANDLES) {
+      idle.push_back(curl);
+      return;
+    }
+  }
+
+  curl_easy_cleanup(curl);
+}
+
 
 static size_t onData(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
@@ -198,9 +291,10 @@ bool http(HttpVerb verb,
   
   OnDataFunc    on_data,
   const std::function<const char*(CURL*)>& on_verify,
-  OnProgressFunc progress_callback)
+  OnProgressFunc progress_callback,
+  HttpPool*     pool)
 {
-  CURL *curl = curl_handle(verb);
+  CURL *curl = pool ? pool->acquire() : curl_handle(verb);
   if (!curl)
       return false;
 
@@ -291,8 +385,351 @@ bool http(HttpVerb verb,
   if(headers)
     curl_slist_free_all(headers);
 
-  // We clean up.
-  curl_easy_cleanup(curl);    /* cleanup */
+  // Pooled handles go back to the pool with their connection kept alive.
+  if(pool)
+    pool->release(curl);
+  else
+    curl_easy_cleanup(curl);    /* cleanup */
 
   return  result;
 }
+
+
+/*
+ * HttpMulti
+ */
+
+struct HttpMulti::Request {
+  HttpVerb verb;
+  std::string url;
+  struct curl_slist* headers = nullptr;
+  std::string body;
+  OnDataFunc on_data;
+  OnDoneFunc on_done;
+  OnVerifyFunc on_verify;
+  OnConnectedFunc on_connected;
+};
+
+struct HttpMulti::Socket {
+  HttpMulti* self;
+  curl_socket_t fd;
+  GIOChannel* channel;
+  GSource* watch;
+};
+
+static size_t discardData(char*, size_t size, size_t nmemb, void*)
+{
+    return size * nmemb;
+}
+
+HttpMulti::HttpMulti(GMainContext* context, HttpPool* pool)
+  : context(context ? g_main_context_ref(context) : g_main_context_ref_thread_default())
+  , pool(pool)
+{
+  curl_init_once();
+
+  multi = curl_multi_init();
+
+  curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+  curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+  curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+}
+
+HttpMulti::~HttpMulti() {
+  for (auto& request : requests) {
+    curl_multi_remove_handle(multi, request.first);
+    release(request.first, *request.second);
+  }
+  requests.clear();
+
+  if (timer) {
+    g_source_destroy(timer);
+    g_source_unref(timer);
+    timer = nullptr;
+  }
+
+  curl_multi_cleanup(multi);
+
+  while (!sockets.empty())
+    remove_socket(sockets.begin()->second);
+
+  g_main_context_unref(context);
+}
+
+CURL* HttpMulti::start(HttpVerb verb,
+  const std::string& url,
+  const std::vector<std::string>& http_headers,
+  std::string body,
+  OnDataFunc on_data,
+  OnDoneFunc on_done,
+  OnVerifyFunc on_verify)
+{
+  CURL *curl = pool ? pool->acquire() : curl_handle(verb);
+  if (!curl)
+      return nullptr;
+
+  auto request = std::make_unique<Request>();
+  request->verb = verb;
+  request->url = url;
+  request->body = std::move(body);
+  request->on_data = std::move(on_data);
+  request->on_done = std::move(on_done);
+  request->on_verify = std::move(on_verify);
+
+  curl_easy_setopt(curl, CURLOPT_URL, request->url.c_str());
+
+  for (const auto& header : http_headers)
+    request->headers = curl_slist_append(request->headers, header.c_str());
+  if (verb == HTTP_POST)
+    request->headers = curl_slist_append(request->headers, "Expect:"); // see http()
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+
+  if (verb == HTTP_POST) {
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->body.data());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)request->body.size());
+  }
+
+  if (request->on_data) {
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, onData);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, static_cast<void*>(&request->on_data));
+  } else {
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discardData);
+  }
+
+  // Rather wait for an existing connection to multiplex on than open another one.
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+  if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+    release(curl, *request);
+    return nullptr;
+  }
+
+  requests.emplace(curl, std::move(request));
+  return curl;
+}
+
+CURL* HttpMulti::connect(const std::string& url,
+  const std::vector<std::string>& http_headers,
+  OnConnectedFunc on_connected)
+{
+  // Never pooled: the connection leaves with the handle.
+  CURL *curl = curl_handle(HTTP_GET);
+  if (!curl)
+      return nullptr;
+
+  auto request = std::make_unique<Request>();
+  request->verb = HTTP_GET;
+  request->url = url;
+  request->on_connected = std::move(on_connected);
+
+  curl_easy_setopt(curl, CURLOPT_URL, request->url.c_str());
+
+  for (const auto& header : http_headers)
+    request->headers = curl_slist_append(request->headers, header.c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+
+  curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 2L);
+
+  if (curl_multi_add_handle(multi, curl) != CURLM_OK) {
+    release(curl, *request);
+    return nullptr;
+  }
+
+  requests.emplace(curl, std::move(request));
+  return curl;
+}
+
+void HttpMulti::cancel(CURL* curl) {
+  auto it = requests.find(curl);
+  if (it == requests.end())
+    return;
+
+  curl_multi_remove_handle(multi, curl);
+  release(curl, *it->second);
+  requests.erase(it);
+}
+
+void HttpMulti::release(CURL* curl, Request& request) {
+  if (request.headers) {
+    curl_slist_free_all(request.headers);
+    request.headers = nullptr;
+  }
+
+  if (pool && !request.on_connected)
+    pool->release(curl);
+  else
+    curl_easy_cleanup(curl);
+}
+
+void HttpMulti::finish(CURL* curl, CURLcode result) {
+  auto it = requests.find(curl);
+  if (it == requests.end())
+    return;
+
+  auto request = std::move(it->second);
+  requests.erase(it);
+
+  if (request->on_connected) {
+    curl_multi_remove_handle(multi, curl);
+    if (result != CURLE_OK) {
+      fprintf(stderr, "%s: curl: %s\n", request->url.c_str(), curl_easy_strerror(result));
+      release(curl, *request);
+      request->on_connected(nullptr);
+      return;
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(request->headers);
+    request->headers = nullptr;
+    request->on_connected(curl);
+    return;
+  }
+
+  bool ok = true;
+
+  if (result != CURLE_OK) {
+    fprintf(stderr, "%s: curl: %s\n", request->url.c_str(), curl_easy_strerror(result));
+    ok = false;
+  }
+
+  if (options.verbosity >= 2)
+    curl_log_result(curl);
+
+  if (ok) {
+    long response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    if (response_code < 200 || response_code >= 300) {
+      fprintf(stderr, "%s: HTTP(S) status code %ld\n", request->url.c_str(), response_code);
+      ok = false;
+    }
+  }
+
+  if (const char* verification_error = request->on_verify ? request->on_verify(curl) : nullptr) {
+    fprintf(stderr, "%s: %s\n", request->url.c_str(), verification_error);
+    ok = false;
+  }
+
+  curl_multi_remove_handle(multi, curl);
+  release(curl, *request);
+
+  if (request->on_done)
+    request->on_done(ok);
+}
+
+void HttpMulti::check_completed() {
+  int pending = 0;
+  while (CURLMsg* msg = curl_multi_info_read(multi, &pending)) {
+    if (msg->msg == CURLMSG_DONE) {
+      // msg is invalidated by finish(); copy what we need first.
+      CURL* curl = msg->easy_handle;
+      CURLcode result = msg->data.result;
+      finish(curl, result);
+    }
+  }
+}
+
+int HttpMulti::socket_callback(CURL*, curl_socket_t s, int what, void* userp, void* socketp) {
+  auto self = static_cast<HttpMulti*>(userp);
+  auto sock = static_cast<Socket*>(socketp);
+
+  if (what == CURL_POLL_REMOVE) {
+    if (sock) {
+      curl_multi_assign(self->multi, s, nullptr);
+      self->remove_socket(sock);
+    }
+    return 0;
+  }
+
+  if (!sock) {
+#ifdef _WIN32
+    GIOChannel* channel = g_io_channel_win32_new_socket(static_cast<gint>(s));
+#else
+    GIOChannel* channel = g_io_channel_unix_new(s);
+#endif
+    sock = new Socket{ self, s, channel, nullptr };
+    self->sockets[s] = sock;
+    curl_multi_assign(self->multi, s, sock);
+  }
+  else if (sock->watch) {
+    g_source_destroy(sock->watch);
+    g_source_unref(sock->watch);
+  }
+
+  int condition = G_IO_ERR | G_IO_HUP;
+  if (what & CURL_POLL_IN)
+    condition |= G_IO_IN | G_IO_PRI;
+  if (what & CURL_POLL_OUT)
+    condition |= G_IO_OUT;
+
+  sock->watch = g_io_create_watch(sock->channel, static_cast<GIOCondition>(condition));
+  g_source_set_callback(sock->watch, (GSourceFunc) on_socket_event, sock, nullptr);
+  g_source_attach(sock->watch, self->context);
+
+  return 0;
+}
+
+void HttpMulti::remove_socket(Socket* sock) {
+  sockets.erase(sock->fd);
+
+  if (sock->watch) {
+    g_source_destroy(sock->watch);
+    g_source_unref(sock->watch);
+  }
+  g_io_channel_unref(sock->channel);
+  delete sock;
+}
+
+gboolean HttpMulti::on_socket_event(GIOChannel*, GIOCondition condition, gpointer data) {
+  // The socket may be removed while curl handles the event.
+  auto sock = static_cast<Socket*>(data);
+  HttpMulti* self = sock->self;
+  const curl_socket_t fd = sock->fd;
+
+  int action = 0;
+  if (condition & (G_IO_IN | G_IO_PRI))
+    action |= CURL_CSELECT_IN;
+  if (condition & G_IO_OUT)
+    action |= CURL_CSELECT_OUT;
+  if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+    action |= CURL_CSELECT_ERR;
+
+  int running = 0;
+  curl_multi_socket_action(self->multi, fd, action, &running);
+  self->check_completed();
+
+  return G_SOURCE_CONTINUE;
+}
+
+gboolean HttpMulti::on_timeout(gpointer data) {
+  auto self = static_cast<HttpMulti*>(data);
+
+  // curl may arm a new timer from within curl_multi_socket_action().
+  g_source_unref(self->timer);
+  self->timer = nullptr;
+
+  int running = 0;
+  curl_multi_socket_action(self->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+  self->check_completed();
+
+  return G_SOURCE_REMOVE;
+}
+
+int HttpMulti::timer_callback(CURLM*, long timeout_ms, void* userp) {
+  auto self = static_cast<HttpMulti*>(userp);
+
+  if (self->timer) {
+    g_source_destroy(self->timer);
+    g_source_unref(self->timer);
+    self->timer = nullptr;
+  }
+
+  if (timeout_ms >= 0) {
+    self->timer = g_timeout_source_new(static_cast<guint>(timeout_ms));
+    g_source_set_callback(self->timer, on_timeout, self, nullptr);
+    g_source_attach(self->timer, self->context);
+  }
+
+  return 0;
+}
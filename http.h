@@ -11,7 +11,14 @@
 #include <string.h>
 #include <curl/curl.h>
 
+#include <glib.h>
+
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 /*
  * send HTTP request.
@@ -26,6 +33,43 @@ typedef std::function<size_t(char*, size_t, size_t)> OnDataFunc;
 
 typedef std::function<size_t(curl_off_t, curl_off_t, curl_off_t, curl_off_t)> OnProgressFunc;
 
+/*
+ * A pool of keep-alive curl handles.
+ *
+ * All handles share one DNS cache, TLS session cache and connection cache,
+ * and are recycled with curl_easy_reset(), which keeps their connections
+ * open. Consecutive requests to the same host therefore go out over an
+ * already established (and, where the server supports it, HTTP/2) connection
+ * instead of paying for DNS, TCP and TLS setup every time.
+ *
+ * The pool is thread safe; it must outlive every handle acquired from it.
+ */
+class HttpPool {
+public:
+    HttpPool();
+    ~HttpPool();
+
+    HttpPool(const HttpPool&) = delete;
+    HttpPool& operator =(const HttpPool&) = delete;
+
+    CURL* acquire();
+    void release(CURL* curl);
+
+    // Whether a finished transfer left a handle, and so likely a kept-alive
+    // connection, behind.
+    bool has_idle_connection();
+
+private:
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr);
+    static void unlock(CURL*, curl_lock_data data, void* userptr);
+
+    CURLSH* share = nullptr;
+    std::mutex share_locks[CURL_LOCK_DATA_LAST];
+
+    std::mutex mtx;
+    std::vector<CURL*> idle;
+};
+
 bool http(HttpVerb  verb,
   const char*   url, 
   const char**  http_headers, 
@@ -35,10 +79,78 @@ bool http(HttpVerb  verb,
 
   OnDataFunc    on_data = {},
   const std::function<const char*(CURL*)>& on_verify = {},
-  OnProgressFunc progress_callback = {}
+  OnProgressFunc progress_callback = {},
+  HttpPool*     pool = nullptr
 );
 
 
+/*
+ * Event-driven HTTP client.
+ *
+ * Runs transfers on a curl multi handle whose sockets and timeouts are
+ * watched by GSources attached to the given GMainContext, so all callbacks
+ * (on_data, on_done) are invoked on the thread iterating that context and
+ * nothing ever blocks it. Concurrent transfers to one host are multiplexed
+ * over a single HTTP/2 connection where the server allows it.
+ *
+ * Not thread safe: use it from the context's thread only, and neither
+ * cancel() a transfer nor destroy the client from inside its callbacks.
+ */
+class HttpMulti {
+public:
+    typedef std::function<void(bool ok)> OnDoneFunc;
+    typedef std::function<const char*(CURL*)> OnVerifyFunc;
+    typedef std::function<void(CURL* curl)> OnConnectedFunc;
+
+    HttpMulti(GMainContext* context, HttpPool* pool = nullptr);
+    ~HttpMulti();
+
+    HttpMulti(const HttpMulti&) = delete;
+    HttpMulti& operator =(const HttpMulti&) = delete;
+
+    // Returns the transfer handle, or nullptr if it could not be started.
+    CURL* start(HttpVerb verb,
+        const std::string& url,
+        const std::vector<std::string>& http_headers,
+        std::string body,
+        OnDataFunc on_data = {},
+        OnDoneFunc on_done = {},
+        OnVerifyFunc on_verify = {});
+
+    // Runs only the connection phase (CURLOPT_CONNECT_ONLY = 2, i.e. up to and
+    // including a WebSocket upgrade), then passes the still connected handle
+    // to on_connected, which takes ownership of it; nullptr on failure.
+    CURL* connect(const std::string& url,
+        const std::vector<std::string>& http_headers,
+        OnConnectedFunc on_connected);
+
+    // Aborts a transfer without calling its on_done.
+    void cancel(CURL* curl);
+
+private:
+    struct Request;
+    struct Socket;
+
+    static int socket_callback(CURL* curl, curl_socket_t s, int what, void* userp, void* socketp);
+    static int timer_callback(CURLM* multi, long timeout_ms, void* userp);
+    static gboolean on_socket_event(GIOChannel* channel, GIOCondition condition, gpointer data);
+    static gboolean on_timeout(gpointer data);
+
+    void remove_socket(Socket* sock);
+    void finish(CURL* curl, CURLcode result);
+    void check_completed();
+    void release(CURL* curl, Request& request);
+
+    GMainContext* context;
+    HttpPool* pool;
+    CURLM* multi = nullptr;
+    GSource* timer = nullptr;
+
+    std::map<CURL*, std::unique_ptr<Request>> requests;
+    std::map<curl_socket_t, Socket*> sockets;
+};
+
+
 /*
  * Aplication options
  */
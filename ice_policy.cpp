@@ -0,0 +1,162 @@
+#include "ice_policy.h"
+
+#include <gio/gio.h>
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+std::vector<GInetAddressMask*> parse_networks(const std::string& list)
+{
+    std::vector<GInetAddressMask*> networks;
+
+    auto items = g_strsplit(list.c_str(), ",", -1);
+    for (auto item = items; *item; ++item) {
+        auto mask = g_strstrip(*item);
+        if (!*mask)
+            continue;
+
+        GError* error = nullptr;
+        if (auto network = g_inet_address_mask_new_from_string(mask, &error))
+            networks.push_back(network);
+        else {
+            qWarning() << "Ignoring ICE network" << mask << ':' << error->message;
+            g_clear_error(&error);
+        }
+    }
+    g_strfreev(items);
+
+    return networks;
+}
+
+std::string to_lower(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return s;
+}
+
+bool is_ipv6(const std::string& address)
+{
+    return address.find(':') != std::string::npos;
+}
+
+} // namespace
+
+bool parse_ice_candidate(const char* candidate, IceCandidateInfo& info)
+{
+    if (!candidate)
+        return false;
+    if (g_str_has_prefix(candidate, "a="))
+        candidate += 2;
+    if (g_str_has_prefix(candidate, "candidate:"))
+        candidate += strlen("candidate:");
+
+    // foundation component transport priority address port "typ" type ...
+    std::istringstream in(candidate);
+    std::string foundation, component, transport, priority, address, port, typ, type;
+    if (!(in >> foundation >> component >> transport >> priority >> address >> port >> typ >> type)
+            || typ != "typ")
+        return false;
+
+    info.transport = to_lower(transport);
+    info.address = address;
+    info.type = type;
+    return true;
+}
+
+IceCandidateFilter::IceCandidateFilter(IceCandidatePolicy candidates, IceAddressFamily family,
+        bool tcp, const std::string& allowed_networks, const std::string& denied_networks)
+    : candidates(candidates)
+    , family(family)
+    , tcp(tcp)
+    , allowed(parse_networks(allowed_networks))
+    , denied(parse_networks(denied_networks))
+{
+}
+
+IceCandidateFilter::~IceCandidateFilter()
+{
+    for (auto network : allowed)
+        g_object_unref(network);
+    for (auto network : denied)
+        g_object_unref(network);
+}
+
+bool IceCandidateFilter::on_networks(const std::vector<GInetAddressMask*>& networks,
+    const std::string& address) const
+{
+    auto inet_address = g_inet_address_new_from_string(address.c_str());
+    if (!inet_address)
+        return false; // mDNS host names and the like
+
+    const bool matches = std::any_of(networks.begin(), networks.end(), [inet_address](GInetAddressMask* network) {
+        return g_inet_address_mask_matches(network, inet_address);
+    });
+    g_object_unref(inet_address);
+    return matches;
+}
+
+// Transport and address family, which apply to both sides of a pair.
+bool IceCandidateFilter::usable(const IceCandidateInfo& info) const
+{
+    if (!tcp && info.transport == "tcp")
+        return false;
+
+    if (family == IceAddressFamily::IPv4Only && is_ipv6(info.address))
+        return false;
+    if (family == IceAddressFamily::IPv6Only && !is_ipv6(info.address))
+        return false;
+    return true;
+}
+
+bool IceCandidateFilter::accept_local(const char* candidate) const
+{
+    IceCandidateInfo info;
+    if (!parse_ice_candidate(candidate, info))
+        return true; // not ours to judge
+
+    if (!usable(info))
+        return false;
+
+    if (candidates == IceCandidatePolicy::HostOnly && info.type != "host")
+        return false;
+    if (candidates == IceCandidatePolicy::RelayOnly && info.type != "relay")
+        return false;
+
+    // Reflexive and relayed addresses are the NAT's and the TURN server's,
+    // not on any of our interfaces.
+    if (info.type != "host")
+        return true;
+
+    if (!allowed.empty() && !on_networks(allowed, info.address))
+        return false;
+    return !on_networks(denied, info.address);
+}
+
+bool IceCandidateFilter::accept_remote(const char* candidate) const
+{
+    IceCandidateInfo info;
+    if (!parse_ice_candidate(candidate, info))
+        return true; // not ours to judge
+
+    return usable(info);
+}
+
+bool IceCandidateFilter::preferred(const char* candidate) const
+{
+    IceCandidateInfo info;
+    if (!parse_ice_candidate(candidate, info))
+        return false;
+
+    switch (family) {
+    case IceAddressFamily::PreferIPv4: return !is_ipv6(info.address);
+    case IceAddressFamily::PreferIPv6: return is_ipv6(info.address);
+    default: return false;
+    }
+}
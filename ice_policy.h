@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+typedef struct _GInetAddressMask GInetAddressMask;
+
+/*
+ * Which ICE candidates take part in a call.
+ *
+ * Candidates on networks that can never reach the peer (container bridges,
+ * VPN tunnels, link-local addresses) only lengthen the check list; the
+ * policy keeps them out of what we send. The candidate types and networks
+ * describe our side only: of the peer's candidates, just the ones of an
+ * address family or transport we do not use are left out.
+ */
+
+enum class IceCandidatePolicy { All, HostOnly, RelayOnly };
+
+enum class IceAddressFamily { Any, PreferIPv4, PreferIPv6, IPv4Only, IPv6Only };
+
+struct IceCandidateInfo
+{
+    std::string transport;   // "udp" or "tcp", lower case
+    std::string address;
+    std::string type;        // "host", "srflx", "prflx" or "relay"
+};
+
+// Parses an a=candidate line, with or without the "candidate:" prefix.
+bool parse_ice_candidate(const char* candidate, IceCandidateInfo& info);
+
+class IceCandidateFilter
+{
+public:
+    // Networks are comma separated CIDR masks ("10.0.0.0/8, fe80::/10");
+    // an empty allow list allows every network.
+    IceCandidateFilter(IceCandidatePolicy candidates, IceAddressFamily family, bool tcp,
+        const std::string& allowed_networks, const std::string& denied_networks);
+    ~IceCandidateFilter();
+
+    IceCandidateFilter(const IceCandidateFilter&) = delete;
+    IceCandidateFilter& operator =(const IceCandidateFilter&) = delete;
+
+    // One of our own candidates, to be sent to the peer.
+    bool accept_local(const char* candidate) const;
+
+    // A candidate received from the peer.
+    bool accept_remote(const char* candidate) const;
+
+    // Whether the candidate is of the preferred address family, to be sent
+    // (and so checked) first.
+    bool preferred(const char* candidate) const;
+
+private:
+    bool usable(const IceCandidateInfo& info) const;
+    bool on_networks(const std::vector<GInetAddressMask*>& networks, const std::string& address) const;
+
+    const IceCandidatePolicy candidates;
+    const IceAddressFamily family;
+    const bool tcp;
+    std::vector<GInetAddressMask*> allowed;
+    std::vector<GInetAddressMask*> denied;
+};
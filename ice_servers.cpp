@@ -0,0 +1,188 @@
+#include "ice_servers.h"
+
+#include <gio/gio.h>
+
+#include <QDebug>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// GResolver does not tell the record's TTL; this is short enough to follow
+// a server moving, long enough to cover the calls of a session.
+const auto RESOLVED_TTL = std::chrono::minutes(5);
+
+struct UriParts
+{
+    std::string prefix;   // scheme and user info
+    std::string host;
+    std::string suffix;   // port and the rest
+};
+
+bool split_uri(const std::string& uri, UriParts& parts)
+{
+    const auto scheme_end = uri.find("://");
+    if (scheme_end == std::string::npos)
+        return false;
+
+    auto host_begin = scheme_end + 3;
+    const auto at = uri.rfind('@');   // TURN credentials
+    if (at != std::string::npos && at > host_begin)
+        host_begin = at + 1;
+
+    size_t host_end;
+    if (uri.compare(host_begin, 1, "[") == 0) {
+        host_end = uri.find(']', host_begin);
+        if (host_end == std::string::npos)
+            return false;
+        ++host_end;
+    } else {
+        host_end = uri.find_first_of(":/?", host_begin);
+        if (host_end == std::string::npos)
+            host_end = uri.size();
+    }
+    if (host_end == host_begin)
+        return false;
+
+    parts.prefix = uri.substr(0, host_begin);
+    parts.host = uri.substr(host_begin, host_end - host_begin);
+    parts.suffix = uri.substr(host_end);
+    return true;
+}
+
+class IceServerResolver
+{
+public:
+    ~IceServerResolver()
+    {
+        g_cancellable_cancel(cancellable);
+        if (thread.joinable())
+            thread.join();
+        g_object_unref(cancellable);
+    }
+
+    void prepare(const std::vector<std::string>& uris)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto& uri : uris) {
+            UriParts parts;
+            if (uri.empty() || !split_uri(uri, parts) || g_hostname_is_ip_address(parts.host.c_str()))
+                continue;
+            auto it = resolved.find(parts.host);
+            if (it != resolved.end() && now - it->second.when < RESOLVED_TTL)
+                continue;
+            pending.push_back(parts.host);
+        }
+
+        if (pending.empty() || running)
+            return;
+
+        if (thread.joinable())
+            thread.join();
+        running = true;
+        thread = std::thread([this] { run(); });
+    }
+
+    std::string resolve(const std::string& uri)
+    {
+        UriParts parts;
+        if (!split_uri(uri, parts))
+            return uri;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = resolved.find(parts.host);
+        if (it == resolved.end()
+                || std::chrono::steady_clock::now() - it->second.when >= RESOLVED_TTL)
+            return uri;
+        return parts.prefix + it->second.address + parts.suffix;
+    }
+
+private:
+    struct Resolved
+    {
+        std::string address;
+        std::chrono::steady_clock::time_point when;
+    };
+
+    void run()
+    {
+        auto resolver = g_resolver_get_default();
+
+        for (;;) {
+            std::string host;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (pending.empty() || g_cancellable_is_cancelled(cancellable)) {
+                    pending.clear();
+                    running = false;
+                    break;
+                }
+                host = std::move(pending.back());
+                pending.pop_back();
+            }
+
+            const auto started = std::chrono::steady_clock::now();
+            GError* error = nullptr;
+            auto addresses = g_resolver_lookup_by_name(resolver, host.c_str(), cancellable, &error);
+            if (!addresses) {
+                qDebug() << "Cannot resolve ICE server" << host.c_str() << ':' << error->message;
+                g_clear_error(&error);
+                continue;
+            }
+
+            // IPv4 first: every STUN/TURN deployment serves it.
+            GInetAddress* chosen = nullptr;
+            for (auto l = addresses; l; l = l->next) {
+                auto address = static_cast<GInetAddress*>(l->data);
+                if (!chosen || g_inet_address_get_family(address) == G_SOCKET_FAMILY_IPV4) {
+                    chosen = address;
+                    if (g_inet_address_get_family(address) == G_SOCKET_FAMILY_IPV4)
+                        break;
+                }
+            }
+
+            auto text = g_inet_address_to_string(chosen);
+            std::string literal = text;
+            g_free(text);
+            if (g_inet_address_get_family(chosen) == G_SOCKET_FAMILY_IPV6)
+                literal = '[' + literal + ']';
+            g_resolver_free_addresses(addresses);
+
+            const auto now = std::chrono::steady_clock::now();
+            qDebug() << "ICE server" << host.c_str() << "resolved to" << literal.c_str() << "in"
+                << std::chrono::duration_cast<std::chrono::milliseconds>(now - started).count() << "ms";
+
+            std::lock_guard<std::mutex> lock(mtx);
+            resolved[host] = { literal, now };
+        }
+
+        g_object_unref(resolver);
+    }
+
+    std::mutex mtx;
+    std::map<std::string, Resolved> resolved;
+    std::vector<std::string> pending;
+    bool running = false;
+    std::thread thread;
+    GCancellable* cancellable = g_cancellable_new();
+};
+
+IceServerResolver ice_server_resolver;
+
+} // namespace
+
+void prepare_ice_servers(const std::string& stun_uri, const std::string& turn_uri)
+{
+    ice_server_resolver.prepare({ stun_uri, turn_uri });
+}
+
+std::string resolved_ice_server(const std::string& uri)
+{
+    return ice_server_resolver.resolve(uri);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+/*
+ * Host names of the STUN and TURN servers, resolved ahead of the call.
+ *
+ * webrtcbin looks the servers up when it starts gathering, that is once the
+ * handshake is over and the offer is being made. Giving it URIs with literal
+ * addresses instead takes that lookup out of call setup.
+ */
+
+// The STUN server used when none is configured.
+#define DEFAULT_STUN_SERVER "stun://stun.l.google.com:19302"
+
+// Starts resolving the hosts of the given stun:// and turn:// URIs in the
+// background; empty URIs are ignored, recently resolved hosts are skipped.
+void prepare_ice_servers(const std::string& stun_uri, const std::string& turn_uri);
+
+// The URI with its host replaced by a resolved address, if one is cached.
+std::string resolved_ice_server(const std::string& uri);
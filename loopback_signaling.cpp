@@ -0,0 +1,335 @@
+#include "signaling_base.h"
+
+#include <gio/gio.h>
+#include <gio/gnetworking.h>
+
+#include <memory>
+
+namespace {
+
+// Both peers derive the same port from the shared session id.
+const guint16 LOOPBACK_PORT_BASE = 47000;
+const guint16 LOOPBACK_PORT_RANGE = 2000;
+
+const guint RECONNECT_INTERVAL_MS = 250;
+const guint32 MAX_FRAME_SIZE = 1 << 20;
+
+guint16 loopback_port(const std::string& session_id)
+{
+    const auto topic = hashed_session_topic(session_id);
+    return LOOPBACK_PORT_BASE + g_str_hash(topic.c_str()) % LOOPBACK_PORT_RANGE;
+}
+
+/*
+ * Signaling between two instances on the same host, for measuring call setup
+ * without the public relay in the way.
+ *
+ * The first peer to come up listens on 127.0.0.1, the second one connects to
+ * it; messages are length-prefixed (4 bytes, big endian). Everything runs on
+ * the thread-default GMainContext of the thread calling connect_to_server_async().
+ */
+class LoopbackSignalingConnection : public HandshakeSignalingConnection
+{
+    typedef std::weak_ptr<LoopbackSignalingConnection*> Token;
+
+    struct ReadOp
+    {
+        Token token;
+        guint32 header = 0;
+        std::string body;
+    };
+
+    struct WriteOp
+    {
+        Token token;
+        std::string frame;
+        std::function<void(bool ok)> done;
+    };
+
+public:
+    explicit LoopbackSignalingConnection(std::string sid)
+        : HandshakeSignalingConnection(std::move(sid))
+        , port(loopback_port(session_id))
+    {}
+
+    ~LoopbackSignalingConnection() override
+    {
+        // Pending GIO callbacks find the token expired and bail out.
+        alive.reset();
+
+        outbound.reset();
+
+        if (reconnect_timer) {
+            g_source_destroy(reconnect_timer);
+            g_source_unref(reconnect_timer);
+        }
+
+        if (cancellable)
+            g_cancellable_cancel(cancellable);
+
+        stop_listening();
+
+        if (connection) {
+            g_io_stream_close(G_IO_STREAM(connection), nullptr, nullptr);
+            g_object_unref(connection);
+        }
+
+        g_clear_object(&cancellable);
+    }
+
+    bool connect_to_server_async() override
+    {
+        outbound = std::make_unique<OutboundQueue>(nullptr,
+            [this](const std::string& message, std::function<void(bool)> done) {
+                write_frame(message, std::move(done));
+            });
+
+        cancellable = g_cancellable_new();
+
+        qDebug() << "Loopback signaling on port" << port;
+        try_connect();
+        return true;
+    }
+
+    void close() override
+    {
+        requestInterrupted = true;
+        if (outbound)
+            outbound->stop();
+        if (cancellable)
+            g_cancellable_cancel(cancellable);
+    }
+
+protected:
+    void transmit(std::string message) override
+    {
+        if (outbound)
+            outbound->push(std::move(message));
+    }
+
+private:
+    static LoopbackSignalingConnection* lock(const Token& token)
+    {
+        auto p = token.lock();
+        return p ? *p : nullptr;
+    }
+
+    void try_connect()
+    {
+        auto client = g_socket_client_new();
+        g_socket_client_connect_to_host_async(client, "127.0.0.1", port, cancellable,
+            on_connected, new Token(alive));
+        g_object_unref(client);
+    }
+
+    static void on_connected(GObject* source, GAsyncResult* res, gpointer user_data)
+    {
+        std::unique_ptr<Token> token(static_cast<Token*>(user_data));
+
+        GError* error = nullptr;
+        auto conn = g_socket_client_connect_to_host_finish(G_SOCKET_CLIENT(source), res, &error);
+
+        auto self = lock(*token);
+        if (!self || self->requestInterrupted) {
+            g_clear_error(&error);
+            g_clear_object(&conn);
+            return;
+        }
+
+        if (conn) {
+            self->adopt(conn);
+            return;
+        }
+
+        g_clear_error(&error);
+
+        // Nobody is listening yet: become the listening side, or try again
+        // if the other peer has beaten us to it in the meantime.
+        if (!self->listen()) {
+            self->reconnect_timer = g_timeout_source_new(RECONNECT_INTERVAL_MS);
+            g_source_set_callback(self->reconnect_timer, on_reconnect, self, nullptr);
+            g_source_attach(self->reconnect_timer, g_main_context_get_thread_default());
+        }
+    }
+
+    static gboolean on_reconnect(gpointer user_data)
+    {
+        auto self = static_cast<LoopbackSignalingConnection*>(user_data);
+        g_source_unref(self->reconnect_timer);
+        self->reconnect_timer = nullptr;
+        self->try_connect();
+        return G_SOURCE_REMOVE;
+    }
+
+    bool listen()
+    {
+        if (service)
+            return true;
+
+        service = g_socket_service_new();
+
+        auto inet_address = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+        auto address = g_inet_socket_address_new(inet_address, port);
+        g_object_unref(inet_address);
+
+        GError* error = nullptr;
+        const bool ok = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+            G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, nullptr, nullptr, &error);
+        g_object_unref(address);
+
+        if (!ok) {
+            qDebug() << "Loopback signaling cannot listen:" << error->message;
+            g_clear_error(&error);
+            g_clear_object(&service);
+            return false;
+        }
+
+        g_signal_connect(service, "incoming", G_CALLBACK(on_incoming), this);
+        g_socket_service_start(service);
+        return true;
+    }
+
+    void stop_listening()
+    {
+        if (!service)
+            return;
+        g_signal_handlers_disconnect_by_data(service, this);
+        g_socket_service_stop(service);
+        g_socket_listener_close(G_SOCKET_LISTENER(service));
+        g_clear_object(&service);
+    }
+
+    static gboolean on_incoming(GSocketService* /*service*/, GSocketConnection* conn,
+        GObject* /*source_object*/, gpointer user_data)
+    {
+        auto self = static_cast<LoopbackSignalingConnection*>(user_data);
+        if (self->connection || self->requestInterrupted)
+            return FALSE;
+
+        self->adopt(G_SOCKET_CONNECTION(g_object_ref(conn)));
+        return TRUE;
+    }
+
+    void adopt(GSocketConnection* conn)
+    {
+        connection = conn;
+        stop_listening();
+
+        if (auto socket = g_socket_connection_get_socket(connection))
+            g_socket_set_option(socket, IPPROTO_TCP, TCP_NODELAY, 1, nullptr);
+
+        read_frame();
+        on_transport_open();
+    }
+
+    void read_frame()
+    {
+        auto op = new ReadOp{ alive };
+        g_input_stream_read_all_async(g_io_stream_get_input_stream(G_IO_STREAM(connection)),
+            &op->header, sizeof(op->header), G_PRIORITY_DEFAULT, cancellable, on_header, op);
+    }
+
+    static void on_header(GObject* source, GAsyncResult* res, gpointer user_data)
+    {
+        std::unique_ptr<ReadOp> op(static_cast<ReadOp*>(user_data));
+
+        gsize bytes_read = 0;
+        const bool ok = g_input_stream_read_all_finish(G_INPUT_STREAM(source), res, &bytes_read, nullptr);
+
+        auto self = lock(op->token);
+        if (!self || self->requestInterrupted)
+            return;
+
+        const auto size = GUINT32_FROM_BE(op->header);
+        if (!ok || bytes_read != sizeof(op->header) || size > MAX_FRAME_SIZE) {
+            self->on_peer_gone();
+            return;
+        }
+
+        op->body.resize(size);
+        auto stream = G_INPUT_STREAM(source);
+        auto buffer = &op->body[0];
+        g_input_stream_read_all_async(stream, buffer, size, G_PRIORITY_DEFAULT, self->cancellable,
+            on_body, op.release());
+    }
+
+    static void on_body(GObject* source, GAsyncResult* res, gpointer user_data)
+    {
+        std::unique_ptr<ReadOp> op(static_cast<ReadOp*>(user_data));
+
+        gsize bytes_read = 0;
+        const bool ok = g_input_stream_read_all_finish(G_INPUT_STREAM(source), res, &bytes_read, nullptr);
+
+        auto self = lock(op->token);
+        if (!self || self->requestInterrupted)
+            return;
+
+        if (!ok || bytes_read != op->body.size()) {
+            self->on_peer_gone();
+            return;
+        }
+
+        self->read_frame();
+        self->on_transport_message(op->body.c_str());
+    }
+
+    void on_peer_gone()
+    {
+        qCritical() << "Loopback signaling peer disconnected";
+        requestInterrupted = true;
+        if (outbound)
+            outbound->stop();
+    }
+
+    void write_frame(const std::string& message, std::function<void(bool)> done)
+    {
+        if (!connection) {
+            done(false);
+            return;
+        }
+
+        const auto size = GUINT32_TO_BE(static_cast<guint32>(message.size()));
+
+        auto op = new WriteOp{ alive, {}, std::move(done) };
+        op->frame.reserve(sizeof(size) + message.size());
+        op->frame.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        op->frame.append(message);
+
+        g_output_stream_write_all_async(g_io_stream_get_output_stream(G_IO_STREAM(connection)),
+            op->frame.data(), op->frame.size(), G_PRIORITY_DEFAULT, cancellable, on_written, op);
+    }
+
+    static void on_written(GObject* source, GAsyncResult* res, gpointer user_data)
+    {
+        std::unique_ptr<WriteOp> op(static_cast<WriteOp*>(user_data));
+
+        GError* error = nullptr;
+        const bool ok = g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), res, nullptr, &error);
+        if (!ok) {
+            if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                qWarning() << "Loopback signaling write failed:" << error->message;
+            g_clear_error(&error);
+        }
+
+        if (lock(op->token))
+            op->done(ok);
+    }
+
+    const guint16 port;
+
+    std::shared_ptr<LoopbackSignalingConnection*> alive = std::make_shared<LoopbackSignalingConnection*>(this);
+
+    GCancellable* cancellable = nullptr;
+    GSocketService* service = nullptr;
+    GSocketConnection* connection = nullptr;
+    GSource* reconnect_timer = nullptr;
+
+    std::unique_ptr<OutboundQueue> outbound;
+};
+
+} // namespace
+
+std::unique_ptr<ISignalingConnection> make_loopback_signaling_connection(std::string sid)
+{
+    return std::make_unique<LoopbackSignalingConnection>(std::move(sid));
+}
@@ -10,6 +10,11 @@
 
 #include "preferences.h"
 #include "globals.h"
+#include "encoder_tuning.h"
+#include "call_setup_benchmark.h"
+
+#include <cstdlib>
+#include <cstring>
 
 static GLogFunc old_handler = nullptr;
 
@@ -46,6 +51,15 @@ int main(int argc, char *argv[])
 {
     gst_init( &argc, &argv );
 
+    if (argc > 1 && strcmp(argv[1], "--encoder-benchmark") == 0)
+        return run_encoder_benchmark();
+
+    if (argc > 1 && strcmp(argv[1], "--call-setup-benchmark") == 0)
+        return run_call_setup_benchmark(argv[0], argc > 2 ? atoi(argv[2]) : CALL_SETUP_THRESHOLD_MS_DEFAULT);
+
+    if (argc > 2 && strcmp(argv[1], "--call-setup-peer") == 0)
+        return run_call_setup_peer(argv[2]);
+
     old_handler = g_log_set_default_handler(
         qt_log_handler,
         nullptr);
@@ -5,17 +5,34 @@
 #include "preferences.h"
 
 #include "sendrecv.h"
+#include "dtls_certificate.h"
 #include "version.h"
 
 #include "globals.h"
 
+#include <QDir>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QSlider>
 #include <QSettings>
+#include <QStandardPaths>
 
 #define STRINGIZE_(str) #str
 #define STRINGIZE(x) STRINGIZE_(x)
 
+// Next to the QSettings store. The registry backend on Windows has no
+// directory, so the application config location is used there instead.
+static PathString dtlsCertificatePath()
+{
+#ifdef _WIN32
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation);
+    return QDir(dir).filePath(QStringLiteral("dtls-certificate.pem")).toStdWString();
+#else
+    const QString dir = QFileInfo(QSettings().fileName()).absolutePath();
+    return QDir(dir).filePath(QStringLiteral("dtls-certificate.pem")).toStdString();
+#endif
+}
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
@@ -61,9 +78,21 @@ MainWindow::MainWindow(QWidget *parent)
 MainWindow::~MainWindow()
 {
     cleanup_and_quit_loop("hand up", false);
+    shutdown_sendrecv();
     delete ui;
 }
 
+void MainWindow::showEvent(QShowEvent* event)
+{
+    QMainWindow::showEvent(event);
+
+    if (static_cast<SignalingTransport>(QSettings().value(SETTING_SIGNALING_TRANSPORT, 0).toInt())
+            == SignalingTransport::Ntfy)
+        warm_up_signaling();
+
+    prepare_dtls_certificate(dtlsCertificatePath());
+}
+
 void MainWindow::onRingingCall()
 {
     // Construct Settings from Qt QSettings (UI layer remains Qt-enabled)
@@ -93,6 +122,29 @@ void MainWindow::onRingingCall()
 
     settings.session_id = QSettings().value(SETTING_SESSION_ID).toString().trimmed().toStdString();
 
+    settings.trickle_ice = QSettings().value(SETTING_TRICKLE_ICE, true).toBool();
+    settings.ice_flush_interval_ms = QSettings().value(SETTING_ICE_FLUSH_INTERVAL_MS, 50).toInt();
+    settings.compact_sdp = QSettings().value(SETTING_COMPACT_SDP, true).toBool();
+    settings.fast_call_setup = QSettings().value(SETTING_FAST_CALL_SETUP, true).toBool();
+    settings.warm_standby = QSettings().value(SETTING_WARM_STANDBY, true).toBool();
+    settings.dtls_certificate_path = dtlsCertificatePath();
+    settings.ice_candidate_policy = static_cast<IceCandidatePolicy>(
+        QSettings().value(SETTING_ICE_CANDIDATES, 0).toInt());
+    settings.ice_address_family = static_cast<IceAddressFamily>(
+        QSettings().value(SETTING_ICE_ADDRESS_FAMILY, 0).toInt());
+    settings.ice_tcp = QSettings().value(SETTING_ICE_TCP, true).toBool();
+    settings.ice_allowed_networks = QSettings().value(SETTING_ICE_ALLOWED_NETWORKS).toString().toStdString();
+    settings.ice_denied_networks = QSettings().value(SETTING_ICE_DENIED_NETWORKS, ICE_DENIED_NETWORKS_DEFAULT)
+        .toString().toStdString();
+    settings.encoder_threads = QSettings().value(SETTING_ENCODER_THREADS, 0).toInt();
+    settings.encoder_token_partitions = QSettings().value(SETTING_ENCODER_TOKEN_PARTITIONS, 0).toInt();
+    settings.encoder_speed = QSettings().value(SETTING_ENCODER_SPEED, 0).toInt();
+    settings.video_codecs = QSettings().value(SETTING_VIDEO_CODECS, VIDEO_CODECS_DEFAULT).toString().toStdString();
+    settings.temporal_layers = QSettings().value(SETTING_TEMPORAL_LAYERS, 1).toInt();
+    settings.signaling_transport = static_cast<SignalingTransport>(
+        QSettings().value(SETTING_SIGNALING_TRANSPORT, 0).toInt());
+    settings.signaling_relay_url = QSettings().value(SETTING_SIGNALING_RELAY_URL).toString().trimmed().toStdString();
+
     // Window handle for rendering: use main window handle here.
     // If you used a dedicated video widget previously, use that widget's winId() instead.
     unsigned long long winid = static_cast<unsigned long long>(ui->videoArea->winId());
@@ -0,0 +1,318 @@
+#include "ntfy_subscriptions.h"
+
+#include "makeguard.h"
+
+#include <json-glib/json-glib.h>
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cstring>
+#include <typeinfo>
+#include <vector>
+
+namespace {
+
+const char* string_member(JsonObject* object, const char* name)
+{
+    return json_object_has_member(object, name) ? json_object_get_string_member(object, name) : nullptr;
+}
+
+const char* verify_sse_response(CURL* curl)
+{
+#define EXPECTED_CONTENT_TYPE "text/event-stream"
+
+    static const char expected_content_type[] = EXPECTED_CONTENT_TYPE;
+
+    const char* content_type;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
+    if (!content_type) content_type = "";
+
+    if (!strncmp(content_type, expected_content_type, strlen(expected_content_type)))
+        return nullptr;
+
+    return "Invalid content_type, should be '" EXPECTED_CONTENT_TYPE "'.";
+}
+
+} // namespace
+
+struct NtfySubscriptions::Stream
+{
+    explicit Stream(NtfySubscriptions* owner)
+        : parser([owner, this](std::string_view /*event*/, std::string_view data, std::string_view /*id*/) {
+            owner->on_stream_event(this, data);
+        })
+    {}
+
+    bool contains(const std::string& topic) const
+    {
+        return std::binary_search(topics.begin(), topics.end(), topic);
+    }
+
+    CURL* request = nullptr;
+    SseParser parser;
+    std::vector<std::string> topics;    // sorted
+    bool open = false;
+};
+
+NtfySubscriptions::NtfySubscriptions(std::string server_url, std::shared_ptr<HttpPool> pool)
+    : server_url(std::move(server_url))
+    , http_pool(std::move(pool))
+    , multi(std::make_unique<HttpMulti>(nullptr, http_pool.get()))
+{
+}
+
+NtfySubscriptions::~NtfySubscriptions()
+{
+    if (timer) {
+        g_source_destroy(timer);
+        g_source_unref(timer);
+    }
+
+    cancel(replaced);
+    cancel(current);
+    multi.reset();
+}
+
+void NtfySubscriptions::subscribe(const std::string& topic, NtfySubscriber* subscriber)
+{
+    auto& entry = topics[topic];
+    entry.subscriber = subscriber;
+    entry.since = 0;
+    entry.open = false;
+    entry.resume = false;
+
+    schedule(RESUBSCRIBE_DELAY_MS);
+}
+
+void NtfySubscriptions::unsubscribe(const std::string& topic)
+{
+    topics.erase(topic);
+}
+
+void NtfySubscriptions::schedule(guint delay_ms)
+{
+    // A pending update covers whatever changed since it was scheduled.
+    if (timer)
+        return;
+
+    timer = g_timeout_source_new(delay_ms);
+    g_source_set_callback(timer, on_timer, this, nullptr);
+    g_source_attach(timer, g_main_context_get_thread_default());
+}
+
+gboolean NtfySubscriptions::on_timer(gpointer data)
+{
+    auto self = static_cast<NtfySubscriptions*>(data);
+
+    g_source_unref(self->timer);
+    self->timer = nullptr;
+
+    self->update();
+
+    return G_SOURCE_REMOVE;
+}
+
+void NtfySubscriptions::update()
+{
+    if (replaced && current && current->open)
+        cancel(replaced);
+
+    // Removed topics stay on the stream until something else changes.
+    if (topics.empty())
+        return;
+
+    const bool covered = current && std::all_of(topics.begin(), topics.end(),
+        [this](const auto& topic) { return current->contains(topic.first); });
+    if (!covered) {
+        start_stream();
+        return;
+    }
+
+    // Topics added back while the stream still carried them.
+    if (current->open)
+        on_stream_open(current.get(), last_event_time);
+}
+
+void NtfySubscriptions::start_stream()
+{
+    auto stream = std::make_unique<Stream>(this);
+    Stream* s = stream.get();
+
+    std::string url = server_url;
+    for (const auto& topic : topics) {
+        if (!s->topics.empty())
+            url += ',';
+        url += topic.first;
+        s->topics.push_back(topic.first);
+    }
+    url += "/sse";
+
+    // Topics that were open pick up what they missed; new ones drop what the
+    // replay brings them by their 'since'.
+    const bool resume = std::any_of(topics.begin(), topics.end(),
+        [](const auto& topic) { return topic.second.open || topic.second.resume; });
+    if (resume && last_event_time)
+        url += "?since=" + std::to_string(last_event_time);
+
+    auto on_data = [s](char *ptr, size_t size, size_t nmemb)->size_t {
+        try {
+            s->parser.feed(ptr, size * nmemb);
+        }
+        catch (const std::exception& ex) {
+            qCritical() << "Exception " << typeid(ex).name() << ": " << ex.what();
+            return 0; // aborts the transfer
+        }
+        return size * nmemb;
+    };
+
+    auto on_done = [this, s](bool /*ok*/) {
+        s->request = nullptr;
+        on_stream_done(s);
+    };
+
+    // The old stream keeps serving its topics until the new one is open.
+    if (current && current->open) {
+        cancel(replaced);
+        replaced = std::move(current);
+    }
+    cancel(current);
+    current = std::move(stream);
+
+    if (replaced)
+        qDebug() << "Signaling subscription updated to" << s->topics.size() << "topics";
+
+    s->request = multi->start(HTTP_GET, url, { "Accept: text/event-stream" }, {},
+        on_data, on_done, verify_sse_response);
+    if (!s->request)
+        on_stream_done(s);
+}
+
+void NtfySubscriptions::on_stream_event(Stream* stream, std::string_view data)
+{
+    auto parser = MakeGuard(json_parser_new(), g_object_unref);
+    if (!json_parser_load_from_data(parser.get(), data.data(), data.size(), nullptr))
+        return;
+
+    auto root = json_parser_get_root(parser.get());
+    if (!JSON_NODE_HOLDS_OBJECT(root))
+        return;
+
+    auto object = json_node_get_object(root);
+    const char* event = string_member(object, "event");
+    if (!event)
+        return;
+
+    const time_t time = json_object_has_member(object, "time")
+        ? static_cast<time_t>(json_object_get_int_member(object, "time")) : 0;
+    last_event_time = std::max(last_event_time, time);
+
+    if (g_str_equal(event, "open")) {
+        on_stream_open(stream, time);
+        return;
+    }
+    if (!g_str_equal(event, "message"))
+        return;
+
+    const char* topic = string_member(object, "topic");
+    auto it = topic ? topics.find(topic) : topics.end();
+    if (it == topics.end() || time < it->second.since)
+        return;
+
+    // Both streams deliver while one replaces the other, and a resumed
+    // stream starts with what was already seen.
+    if (is_duplicate(string_member(object, "id"), time))
+        return;
+
+    if (auto text = string_member(object, "message"))
+        it->second.subscriber->on_subscription_message(text);
+}
+
+void NtfySubscriptions::on_stream_open(Stream* stream, time_t time)
+{
+    stream->open = true;
+    if (stream != current.get())
+        return;
+
+    reconnect_attempts = 0;
+
+    // Not from within the transfer's callbacks.
+    if (replaced)
+        schedule(0);
+
+    std::vector<NtfySubscriber*> opened;
+    for (auto& topic : topics) {
+        if (!topic.second.open && current->contains(topic.first)) {
+            if (!topic.second.resume)
+                topic.second.since = time;
+            topic.second.open = true;
+            topic.second.resume = false;
+            opened.push_back(topic.second.subscriber);
+        }
+    }
+    for (auto subscriber : opened)
+        subscriber->on_subscription_open();
+}
+
+void NtfySubscriptions::on_stream_done(Stream* stream)
+{
+    if (stream == replaced.get()) {
+        replaced.reset();
+        return;
+    }
+    if (stream != current.get())
+        return;
+
+    current.reset();
+
+    const auto delay = std::min<guint>(RECONNECT_MAX_DELAY_MS,
+        RECONNECT_BASE_DELAY_MS << std::min(reconnect_attempts, 8));
+    ++reconnect_attempts;
+
+    // The replacement failed; the old stream still serves what it did.
+    if (replaced) {
+        current = std::move(replaced);
+        schedule(delay);
+        return;
+    }
+
+    std::vector<NtfySubscriber*> lost;
+    for (auto& topic : topics) {
+        if (topic.second.open) {
+            topic.second.open = false;
+            topic.second.resume = true;
+            lost.push_back(topic.second.subscriber);
+        }
+    }
+    for (auto subscriber : lost)
+        subscriber->on_subscription_lost();
+
+    if (!topics.empty())
+        schedule(delay);
+}
+
+void NtfySubscriptions::cancel(std::unique_ptr<Stream>& stream)
+{
+    if (!stream)
+        return;
+    if (stream->request)
+        multi->cancel(stream->request);
+    stream.reset();
+}
+
+bool NtfySubscriptions::is_duplicate(const char* id, time_t time)
+{
+    if (!id)
+        return false;
+    if (!recent_ids.emplace(id, time).second)
+        return true;
+
+    // Only what a stream resuming from last_event_time replays is kept.
+    for (auto it = recent_ids.begin(); it != recent_ids.end(); ) {
+        if (it->second < last_event_time)
+            it = recent_ids.erase(it);
+        else
+            ++it;
+    }
+    return false;
+}
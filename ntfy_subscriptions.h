@@ -0,0 +1,106 @@
+#pragma once
+
+#include "http.h"
+#include "sse_parser.h"
+
+#include <glib.h>
+
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class NtfySubscriber
+{
+public:
+    virtual ~NtfySubscriber() = default;
+
+    // The stream carries the topic; called again once it is back after a drop.
+    virtual void on_subscription_open() = 0;
+    virtual void on_subscription_message(const char* text) = 0;
+    // The stream dropped and is being reopened.
+    virtual void on_subscription_lost() = 0;
+};
+
+/*
+ * One ntfy SSE stream shared by all the sessions on a GMainContext.
+ *
+ * ntfy takes a comma separated list of topics on a single subscription, so
+ * any number of sessions cost one long-lived request on one (multiplexed)
+ * connection; events are handed to the subscriber of their topic.
+ *
+ * Topic changes are batched over RESUBSCRIBE_DELAY_MS, and the new stream
+ * replaces the old one only once it is open, so the topics that stay see no
+ * gap. Removing a topic does not resubscribe: its events are dropped until
+ * the stream is reopened for some other reason.
+ *
+ * Not thread safe: use it from the context's thread only.
+ */
+class NtfySubscriptions
+{
+public:
+    enum { RESUBSCRIBE_DELAY_MS = 100, RECONNECT_BASE_DELAY_MS = 250, RECONNECT_MAX_DELAY_MS = 30000 };
+
+    // Topics are appended to server_url, which ends with a slash.
+    NtfySubscriptions(std::string server_url, std::shared_ptr<HttpPool> pool);
+    ~NtfySubscriptions();
+
+    NtfySubscriptions(const NtfySubscriptions&) = delete;
+    NtfySubscriptions& operator =(const NtfySubscriptions&) = delete;
+
+    void subscribe(const std::string& topic, NtfySubscriber* subscriber);
+    void unsubscribe(const std::string& topic);
+
+    const std::shared_ptr<HttpPool>& pool() const { return http_pool; }
+
+    // The stream's multi handle. curl multiplexes a request onto a busy
+    // HTTP/2 connection only within one multi handle, so requests started
+    // here share the stream's connection instead of opening another.
+    HttpMulti& http() { return *multi; }
+
+private:
+    struct Stream;
+
+    struct Topic
+    {
+        NtfySubscriber* subscriber = nullptr;
+        // Server time of the 'open' event of the first stream carrying it, 0
+        // until then; older events were cached before it was added, and are
+        // not ours.
+        time_t since = 0;
+        bool open = false;
+        bool resume = false;    // was open when the stream dropped
+    };
+
+    void schedule(guint delay_ms);
+    static gboolean on_timer(gpointer data);
+    void update();
+
+    void start_stream();
+    void on_stream_event(Stream* stream, std::string_view data);
+    void on_stream_open(Stream* stream, time_t time);
+    void on_stream_done(Stream* stream);
+    void cancel(std::unique_ptr<Stream>& stream);
+
+    bool is_duplicate(const char* id, time_t time);
+
+    const std::string server_url;
+    std::shared_ptr<HttpPool> http_pool;
+    std::unique_ptr<HttpMulti> multi;
+
+    std::map<std::string, Topic> topics;
+
+    std::unique_ptr<Stream> current;
+    std::unique_ptr<Stream> replaced;   // kept until 'current' is open
+
+    GSource* timer = nullptr;
+    int reconnect_attempts = 0;
+
+    // Resume point, in server time, and the messages seen at about that time:
+    // a resumed stream replays the second it resumes from. Only a stream
+    // carrying topics that were open resumes; one for new topics alone starts
+    // from now.
+    time_t last_event_time = 0;
+    std::map<std::string, time_t> recent_ids;
+};
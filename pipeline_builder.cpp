@@ -0,0 +1,255 @@
+#include "pipeline_builder.h"
+
+#include <map>
+#include <sstream>
+
+namespace {
+
+const char* stage_name(PipelineBuilder::Stage stage)
+{
+    switch (stage) {
+    case PipelineBuilder::Stage::Source: return "source";
+    case PipelineBuilder::Stage::Convert: return "convert";
+    case PipelineBuilder::Stage::Encode: return "encode";
+    case PipelineBuilder::Stage::Payload: return "payload";
+    case PipelineBuilder::Stage::Caps: return "caps";
+    }
+    return "unknown";
+}
+
+bool apply_property(GstElement* element, const std::string& property, const std::string& value,
+    std::string& error)
+{
+    auto pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), property.c_str());
+    if (!pspec) {
+        error = std::string(GST_OBJECT_NAME(element)) + " has no property '" + property + '\'';
+        return false;
+    }
+
+    GValue v = G_VALUE_INIT;
+    g_value_init(&v, G_PARAM_SPEC_VALUE_TYPE(pspec));
+    const bool ok = gst_value_deserialize(&v, value.c_str());
+    if (ok)
+        g_object_set_property(G_OBJECT(element), property.c_str(), &v);
+    else
+        error = "invalid value '" + value + "' for " + GST_OBJECT_NAME(element) + "::" + property;
+    g_value_unset(&v);
+    return ok;
+}
+
+} // namespace
+
+GstElement* build_element(const ElementSpec& spec, std::string& error)
+{
+    auto factory = gst_element_factory_find(spec.factory.c_str());
+    if (!factory) {
+        error = "no such element: " + spec.factory;
+        return nullptr;
+    }
+    auto element = gst_element_factory_create(factory, spec.name.empty() ? nullptr : spec.name.c_str());
+    gst_object_unref(factory);
+    if (!element) {
+        error = "cannot create " + spec.factory;
+        return nullptr;
+    }
+
+    for (const auto& property : spec.properties) {
+        if (!apply_property(element, property.first, property.second, error)) {
+            gst_object_unref(element);
+            return nullptr;
+        }
+    }
+
+    return element;
+}
+
+PipelineBuilder::PipelineBuilder(std::string bin_name)
+    : bin_name(std::move(bin_name))
+{
+}
+
+PipelineBuilder& PipelineBuilder::branch(std::string pad_name)
+{
+    branches.push_back({ std::move(pad_name), {} });
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::source(std::string launch_fragment)
+{
+    Step step{ Stage::Source };
+    step.launch_fragment = std::move(launch_fragment);
+    if (branches.empty())
+        branch("src");
+    branches.back().steps.push_back(std::move(step));
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::caps(std::string caps)
+{
+    Step step{ Stage::Caps };
+    step.spec.factory = "capsfilter";
+    step.caps = std::move(caps);
+    if (branches.empty())
+        branch("src");
+    branches.back().steps.push_back(std::move(step));
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::add(Stage stage, ElementSpec spec)
+{
+    if (branches.empty())
+        branch("src");
+    branches.back().steps.push_back({ stage, std::move(spec) });
+    return *this;
+}
+
+PipelineBuilder& PipelineBuilder::probe(GstPadProbeType mask, GstPadProbeCallback callback,
+    gpointer user_data)
+{
+    if (!branches.empty() && !branches.back().steps.empty())
+        branches.back().steps.back().probes.push_back({ mask, callback, user_data });
+    return *this;
+}
+
+bool PipelineBuilder::fail(std::string message)
+{
+    if (error_message.empty())
+        error_message = std::move(message);
+    return false;
+}
+
+GstElement* PipelineBuilder::build_step(const Branch& branch, const Step& step)
+{
+    std::string error;
+    GstElement* element = nullptr;
+
+    switch (step.stage) {
+    case Stage::Source:
+    {
+        GError* parse_error = nullptr;
+        element = gst_parse_bin_from_description(step.launch_fragment.c_str(), TRUE, &parse_error);
+        if (parse_error) {
+            error = parse_error->message;
+            g_error_free(parse_error);
+            if (element)
+                gst_object_unref(element);
+            element = nullptr;
+        }
+        break;
+    }
+    case Stage::Caps:
+    {
+        auto caps = gst_caps_from_string(step.caps.c_str());
+        if (!caps) {
+            error = "invalid caps: " + step.caps;
+            break;
+        }
+        element = build_element(step.spec, error);
+        if (element)
+            g_object_set(element, "caps", caps, nullptr);
+        gst_caps_unref(caps);
+        break;
+    }
+    default:
+        element = build_element(step.spec, error);
+        break;
+    }
+
+    if (!element)
+        fail(branch.pad_name + '/' + stage_name(step.stage) + ": " + error);
+    return element;
+}
+
+GstElement* PipelineBuilder::build()
+{
+    error_message.clear();
+    stage_timings.clear();
+
+    auto todo = std::move(branches);
+    branches.clear();
+
+    auto bin = gst_bin_new(bin_name.empty() ? nullptr : bin_name.c_str());
+    gst_object_ref_sink(bin);
+
+    std::map<std::string, size_t> timing_index;
+    bool ok = true;
+
+    for (auto& branch : todo) {
+        GstElement* previous = nullptr;
+
+        for (const auto& step : branch.steps) {
+            if (!ok)
+                break;
+
+            const auto started = std::chrono::steady_clock::now();
+
+            auto element = build_step(branch, step);
+            if (!element) {
+                ok = false;
+                break;
+            }
+
+            gst_bin_add(GST_BIN(bin), element);
+            if (previous && !gst_element_link(previous, element)) {
+                ok = fail(branch.pad_name + ": cannot link " + GST_OBJECT_NAME(previous)
+                    + " to " + GST_OBJECT_NAME(element));
+                break;
+            }
+
+            for (const auto& probe : step.probes) {
+                auto pad = gst_element_get_static_pad(element, "src");
+                if (pad) {
+                    gst_pad_add_probe(pad, probe.mask, probe.callback, probe.user_data, nullptr);
+                    gst_object_unref(pad);
+                }
+            }
+
+            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - started);
+            const auto key = branch.pad_name + '/' + stage_name(step.stage);
+            auto it = timing_index.find(key);
+            if (it == timing_index.end()) {
+                timing_index.emplace(key, stage_timings.size());
+                stage_timings.push_back({ key, elapsed });
+            } else {
+                stage_timings[it->second].duration += elapsed;
+            }
+
+            previous = element;
+        }
+
+        if (!ok)
+            break;
+
+        if (!previous) {
+            ok = fail(branch.pad_name + ": empty branch");
+            break;
+        }
+
+        auto pad = gst_element_get_static_pad(previous, "src");
+        if (!pad) {
+            ok = fail(branch.pad_name + ": " + GST_OBJECT_NAME(previous) + " has no src pad");
+            break;
+        }
+        gst_element_add_pad(bin, gst_ghost_pad_new(branch.pad_name.c_str(), pad));
+        gst_object_unref(pad);
+    }
+
+    if (!ok) {
+        gst_object_unref(bin);
+        return nullptr;
+    }
+
+    return bin;
+}
+
+std::string PipelineBuilder::timings_summary() const
+{
+    std::ostringstream out;
+    for (const auto& timing : stage_timings) {
+        if (out.tellp() > 0)
+            out << ", ";
+        out << timing.name << ' ' << timing.duration.count() / 1000.0 << " ms";
+    }
+    return out.str();
+}
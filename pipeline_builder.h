@@ -0,0 +1,121 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Typed construction of the media part of the pipeline.
+ *
+ * Instead of concatenating gst-launch fragments, every element is described
+ * by an ElementSpec (factory, name, properties given in their gst-launch
+ * textual form) and placed in a stage of a branch:
+ *
+ *   source -> convert -> encode -> payload -> caps -> ghost src pad
+ *
+ * Nothing is created until build(), which checks that each factory exists and
+ * each property is known to it and accepts the value, links every stage with
+ * its neighbours and reports the first problem instead of a half-built bin.
+ * The time spent on each stage is recorded.
+ */
+
+struct ElementSpec
+{
+    ElementSpec() = default;
+    explicit ElementSpec(std::string factory, std::string name = {})
+        : factory(std::move(factory)), name(std::move(name))
+    {}
+
+    ElementSpec& set(const char* property, std::string value)
+    {
+        properties.emplace_back(property, std::move(value));
+        return *this;
+    }
+
+    std::string factory;
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> properties;
+};
+
+// Creates the element and applies the properties; nullptr and 'error' set on
+// failure. The result is floating, as with gst_element_factory_make().
+GstElement* build_element(const ElementSpec& spec, std::string& error);
+
+class PipelineBuilder
+{
+public:
+    enum class Stage { Source, Convert, Encode, Payload, Caps };
+
+    struct StageTiming
+    {
+        std::string name;                   // "<branch>/<stage>"
+        std::chrono::microseconds duration;
+    };
+
+    explicit PipelineBuilder(std::string bin_name);
+
+    PipelineBuilder(const PipelineBuilder&) = delete;
+    PipelineBuilder& operator =(const PipelineBuilder&) = delete;
+
+    // Starts a branch whose last element is exposed as the ghost src pad
+    // 'pad_name' of the bin.
+    PipelineBuilder& branch(std::string pad_name);
+
+    // A user supplied gst-launch fragment, e.g. "autovideosrc".
+    PipelineBuilder& source(std::string launch_fragment);
+
+    PipelineBuilder& convert(ElementSpec spec) { return add(Stage::Convert, std::move(spec)); }
+    PipelineBuilder& encode(ElementSpec spec) { return add(Stage::Encode, std::move(spec)); }
+    PipelineBuilder& payload(ElementSpec spec) { return add(Stage::Payload, std::move(spec)); }
+    PipelineBuilder& caps(std::string caps);
+
+    // Appends an element of the given stage to the current branch.
+    PipelineBuilder& add(Stage stage, ElementSpec spec);
+
+    // Installs a probe on the src pad of the element added last.
+    PipelineBuilder& probe(GstPadProbeType mask, GstPadProbeCallback callback, gpointer user_data);
+
+    // Returns the bin (a full reference), or nullptr with error() describing
+    // why. The description is consumed either way.
+    GstElement* build();
+
+    const std::string& error() const { return error_message; }
+    const std::vector<StageTiming>& timings() const { return stage_timings; }
+
+    // One line with the cost of every stage, for the log.
+    std::string timings_summary() const;
+
+private:
+    struct Probe
+    {
+        GstPadProbeType mask;
+        GstPadProbeCallback callback;
+        gpointer user_data;
+    };
+
+    struct Step
+    {
+        Stage stage;
+        ElementSpec spec;
+        std::string launch_fragment;        // Stage::Source only
+        std::string caps;                   // Stage::Caps only
+        std::vector<Probe> probes;
+    };
+
+    struct Branch
+    {
+        std::string pad_name;
+        std::vector<Step> steps;
+    };
+
+    GstElement* build_step(const Branch& branch, const Step& step);
+    bool fail(std::string message);
+
+    std::string bin_name;
+    std::vector<Branch> branches;
+    std::string error_message;
+    std::vector<StageTiming> stage_timings;
+};
@@ -2,17 +2,24 @@
 #include "ui_preferences.h"
 
 #include "globals.h"
+#include "signaling_connection.h"
 
 #include <QSettings>
 #include <QDebug>
 #include <QMessageBox>
 #include <QFileDialog>
 
+#include <algorithm>
+#include <iterator>
+
 
 namespace {
 
 const int sliceIntervalValues[] = { 1, 2, 5, 10, 30 };
 
+// comboBox_tokenPartitions entries; zero is "Auto".
+const int tokenPartitionValues[] = { 0, 1, 2, 4, 8 };
+
 void InitSliceDurationsCombo(QComboBox* combo)
 {
     combo->addItem(QObject::tr("No slice"));
@@ -70,10 +77,31 @@ Preferences::Preferences(QWidget *parent) :
     QSettings settings;
 
     ui->lineEdit_SessionID->setText(settings.value(SETTING_SESSION_ID).toString());
+    ui->comboBox_signaling->setCurrentIndex(settings.value(SETTING_SIGNALING_TRANSPORT, 0).toInt());
+    ui->lineEdit_RelayUrl->setText(settings.value(SETTING_SIGNALING_RELAY_URL).toString());
 
     ui->checkBox_TURN->setChecked(settings.value(SETTING_USE_TURN).toBool());
     ui->lineEdit_TURN->setText(settings.value(SETTING_TURN).toString());
 
+    ui->comboBox_iceCandidates->setCurrentIndex(settings.value(SETTING_ICE_CANDIDATES, 0).toInt());
+    ui->comboBox_iceFamily->setCurrentIndex(settings.value(SETTING_ICE_ADDRESS_FAMILY, 0).toInt());
+    ui->checkBox_iceTcp->setChecked(settings.value(SETTING_ICE_TCP, true).toBool());
+    ui->lineEdit_iceAllowed->setText(settings.value(SETTING_ICE_ALLOWED_NETWORKS).toString());
+    ui->lineEdit_iceDenied->setText(
+        settings.value(SETTING_ICE_DENIED_NETWORKS, ICE_DENIED_NETWORKS_DEFAULT).toString());
+
+    ui->spinBox_encoderThreads->setValue(settings.value(SETTING_ENCODER_THREADS, 0).toInt());
+    {
+        const int partitions = settings.value(SETTING_ENCODER_TOKEN_PARTITIONS, 0).toInt();
+        const auto it = std::find(std::begin(tokenPartitionValues), std::end(tokenPartitionValues), partitions);
+        ui->comboBox_tokenPartitions->setCurrentIndex(
+            it != std::end(tokenPartitionValues) ? int(it - std::begin(tokenPartitionValues)) : 0);
+    }
+    ui->spinBox_encoderSpeed->setValue(settings.value(SETTING_ENCODER_SPEED, 0).toInt());
+    ui->lineEdit_videoCodecs->setText(settings.value(SETTING_VIDEO_CODECS, VIDEO_CODECS_DEFAULT).toString());
+    ui->comboBox_temporalLayers->setCurrentIndex(
+        qBound(0, settings.value(SETTING_TEMPORAL_LAYERS, 1).toInt() - 1, ui->comboBox_temporalLayers->count() - 1));
+
     (settings.value(SETTING_AUTOVIDEOSRC, true).toBool()
         ? ui->autoVideoSrc : ui->gstreamerSource)->setChecked(true);
 
@@ -241,13 +269,37 @@ void Preferences::on_pushButton_chooseSavePath_clicked()
 
 void Preferences::accept()
 {
+    if (static_cast<SignalingTransport>(ui->comboBox_signaling->currentIndex()) == SignalingTransport::WebSocket
+        && ui->lineEdit_RelayUrl->text().trimmed().isEmpty())
+    {
+        QMessageBox::warning(this, tr("No relay URL"),
+            tr("WebSocket signaling needs the ws:// or wss:// URL of a relay."));
+        ui->lineEdit_RelayUrl->setFocus();
+        return;
+    }
+
     QSettings settings;
 
     settings.setValue(SETTING_SESSION_ID, ui->lineEdit_SessionID->text());
+    settings.setValue(SETTING_SIGNALING_TRANSPORT, ui->comboBox_signaling->currentIndex());
+    settings.setValue(SETTING_SIGNALING_RELAY_URL, ui->lineEdit_RelayUrl->text());
 
     settings.setValue(SETTING_USE_TURN, ui->checkBox_TURN->isChecked());
     settings.setValue(SETTING_TURN, ui->lineEdit_TURN->text());
 
+    settings.setValue(SETTING_ICE_CANDIDATES, ui->comboBox_iceCandidates->currentIndex());
+    settings.setValue(SETTING_ICE_ADDRESS_FAMILY, ui->comboBox_iceFamily->currentIndex());
+    settings.setValue(SETTING_ICE_TCP, ui->checkBox_iceTcp->isChecked());
+    settings.setValue(SETTING_ICE_ALLOWED_NETWORKS, ui->lineEdit_iceAllowed->text());
+    settings.setValue(SETTING_ICE_DENIED_NETWORKS, ui->lineEdit_iceDenied->text());
+
+    settings.setValue(SETTING_ENCODER_THREADS, ui->spinBox_encoderThreads->value());
+    settings.setValue(SETTING_ENCODER_TOKEN_PARTITIONS,
+        tokenPartitionValues[std::max(0, ui->comboBox_tokenPartitions->currentIndex())]);
+    settings.setValue(SETTING_ENCODER_SPEED, ui->spinBox_encoderSpeed->value());
+    settings.setValue(SETTING_VIDEO_CODECS, ui->lineEdit_videoCodecs->text());
+    settings.setValue(SETTING_TEMPORAL_LAYERS, ui->comboBox_temporalLayers->currentIndex() + 1);
+
     settings.setValue(SETTING_AUTOVIDEOSRC, ui->autoVideoSrc->isChecked());
     settings.setValue(SETTING_AUTOAUDIOSRC, ui->autoAudioSrc->isChecked());
 
@@ -2,6 +2,14 @@
 
 #include "isendrecv.h"
 #include "signaling_connection.h"
+#include "compact_sdp.h"
+#include "pipeline_builder.h"
+#include "dtls_certificate.h"
+#include "ice_servers.h"
+#include "ice_policy.h"
+#include "encoder_tuning.h"
+#include "codec_registry.h"
+#include "temporal_layers.h"
 //#include "globals.h"
 #include "makeguard.h"
 
@@ -12,13 +20,19 @@
 #define GST_USE_UNSTABLE_API
 #include <gst/webrtc/webrtc.h>
 
+#include <gst/video/video.h>
 #include <gst/video/videooverlay.h>
 
 #include <json-glib/json-glib.h>
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <map>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 #include <atomic>
 #include <memory>
 #include <mutex>
@@ -180,7 +194,7 @@ private:
 };
 
 // Generate a unique timestamped filename under g_settings.save_path. Returns a newly g_strdup'd UTF-8 string.
-static gchar* prepare_next_file_name()
+static gchar* prepare_next_file_name(const char* extension)
 {
     using namespace std::chrono;
 
@@ -211,7 +225,7 @@ static gchar* prepare_next_file_name()
         std::ostringstream fn;
         fn << name;
         if (i > 0) fn << "(" << i << ")";
-        fn << ".webm";
+        fn << extension;
         candidate = base / fn.str();
         ++i;
     } while (std::filesystem::exists(candidate));
@@ -221,19 +235,20 @@ static gchar* prepare_next_file_name()
     return g_strdup(utf8.c_str());
 }
 
+// The user data is the file name extension of the muxer's format.
 static gchar* splitmuxsink_on_format_location_full(GstElement* /*splitmux*/,
     guint /*fragment_id*/,
     GstSample* /*first_sample*/,
-    gpointer /*user_data*/)
+    gpointer user_data)
 {
-    auto nextfilename = prepare_next_file_name();
+    auto nextfilename = prepare_next_file_name(static_cast<const char*>(user_data));
     g_print("New file name generated for recording as %s \n", nextfilename);
     // GStreamer expects the returned gchar* to be owned by caller (g_free by sink)
     return nextfilename;
 }
 
 static gboolean
-check_plugins()
+find_required_plugins()
 {
     const gchar* needed[] = { "opus", "vpx", "nice", "webrtc", "dtls", "srtp",
       "rtpmanager", "videotestsrc", "audiotestsrc", nullptr
@@ -253,6 +268,15 @@ check_plugins()
     return ret;
 }
 
+/* The plugin set does not change while we run, so the registry is only
+ * walked for the first call. */
+static gboolean
+check_plugins()
+{
+    static const gboolean found = find_required_plugins();
+    return found;
+}
+
 
 ////////////////////////////////////////////////////////////////////
 
@@ -285,7 +309,15 @@ const static gboolean remote_is_offerer = FALSE;
 
 class SendRecv
 {
-    GMainLoop *loop = nullptr;
+    /* The media engine: one worker thread with its own main context, started
+     * with the first call and reused for every call after it. Calls are run
+     * as tasks on that context; hanging up only tears the call down. */
+    GMainContext* engine_context = nullptr;
+    GMainLoop* engine_loop = nullptr;
+    GThread* engine_thread = nullptr;
+    std::mutex engine_mtx;
+    bool in_call = false;               /* guarded by engine_mtx */
+
     GstElement *pipe1 = nullptr;
     GstElement *webrtc1 = nullptr;
 
@@ -294,6 +326,22 @@ class SendRecv
     guint webrtcbin_get_stats_id = 0;
 
     std::vector<std::pair<int, std::string>> ice_candidates;
+    std::mutex ice_mtx;                 /* guards the ICE trickle state below */
+    guint ice_flush_id = 0;
+    bool local_description_sent = false;
+    bool first_candidate_sent = false;
+
+    /* ICE policy of the current call, and what it let through */
+    std::unique_ptr<IceCandidateFilter> ice_filter;
+    struct CandidateCount { int local = 0; int remote = 0; };
+    std::map<std::string, CandidateCount> candidate_counts;   /* by transport and family */
+    int filtered_candidates = 0;
+
+    /* ICE restart: when connectivity is lost the offerer renegotiates with
+     * fresh credentials, leaving the media branches alone */
+    guint ice_restart_id = 0;           /* guarded by ice_mtx, as are the two below */
+    int ice_restart_attempts = 0;
+    std::chrono::steady_clock::time_point ice_lost_time{};
 
     guintptr xwinid{};
 
@@ -301,23 +349,124 @@ class SendRecv
 
     std::unique_ptr<ISignalingConnection> signaling_connection;
 
-    GThread* gthread = nullptr;
-
     GstClockTime last_video_pts{};
 
+    /* Warm standby: capture and encoders survive the call in READY, only
+     * webrtcbin and the receiving side are created anew for each call. */
+    GstElement* media_source = nullptr;
+    std::string media_source_description;
+    bool media_source_warm = false;
+
+    /* The video transceiver's codec-preferences, as last set */
+    std::string video_codec_preferences;
+
+    /* Video codec of the media source last built, and its encoder */
+    const VideoCodec* video_codec = nullptr;
+    const VideoEncoder* video_encoder_spec = nullptr;
+
+    /* VP8 temporal layers of the media source; the top ones are left out
+     * when the bandwidth estimate falls (see temporal_layer_probe) */
+    int temporal_layers = 1;
+    std::atomic<int> temporal_layers_sent{1};
+    std::atomic<guint> layer_dropped_frames{0};
+
+    /* An offer for another video codec is set once the new encoder's caps
+     * have reached webrtcbin (see switch_video_codec()) */
+    GstWebRTCSessionDescription* deferred_offer = nullptr;
+    guint deferred_offer_id = 0;
+    std::chrono::steady_clock::time_point answer_time{};
+
+    /* DTLS: the cached certificate given to webrtcbin's transports, and the
+     * handshake timing */
+    std::string dtls_pem;
+    std::chrono::steady_clock::time_point ice_connected_time{};
+    bool dtls_reported = false;
+
+    /* Congestion control: set up when webrtcbin asks for its aux sender,
+     * updated from the estimator's notifications on a streaming thread */
+    GstElement* video_encoder = nullptr;
+    guint audio_reserve = 0;
+    std::atomic<guint> estimated_bitrate{0};
+    std::atomic<guint> video_target_bitrate{0};
+    guint reported_bitrate = 0;
+
+    /* Keyframes: the encoder runs a long GOP and forces keyframes only when
+     * asked to, at most one per KEYFRAME_MIN_INTERVAL_MS */
+    std::mutex keyframe_mtx;            /* guards the state below */
+    std::chrono::steady_clock::time_point last_forced_keyframe{};
+    bool keyframe_request_deferred = false;
+    guint32 replayed_request_seqnum = GST_SEQNUM_INVALID;
+    guint keyframes = 0;
+    guint64 keyframe_bytes = 0;
+    guint keyframe_requests = 0;
+    guint keyframe_requests_deferred = 0;
+
+    /* Time spent in the video encoder, across the calls of a warm source */
+    EncodeLatencyMeter encode_latency;
+
+    std::chrono::steady_clock::time_point call_setup_start{};
+
+    /* Fast call setup: the pipeline is built as soon as signaling starts, the
+     * offer is created once the peer is known and goes out the moment the
+     * handshake completes. */
+    bool prebuilt = false;
+    std::mutex fast_mtx;                /* guards the state below */
+    bool negotiation_needed = false;
+    bool is_offerer = false;
+    bool offer_requested = false;
+    bool handshake_done = false;
+    GstWebRTCSessionDescription* pending_offer = nullptr;
+
     std::mutex mtx;
 
 public:
 
+/* Call setup milestones, measured from the moment signaling is started */
+void mark_call_setup(const char* milestone)
+{
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - call_setup_start).count();
+    gst_print("Call setup: %s after %lld ms\n", milestone, static_cast<long long>(elapsed));
+}
+
 bool set_connected()
 {
     if (app_state < PEER_CONNECTED) {
         app_state = PEER_CONNECTED;
+        mark_call_setup("SYN/ACK");
         return true;
     }
     return false;
 }
 
+/* Sources of the current call live on the engine context, so that they never
+ * end up being dispatched by whoever else iterates the default one. */
+guint add_engine_source(guint interval_ms, GSourceFunc func)
+{
+    auto source = interval_ms ? g_timeout_source_new(interval_ms) : g_idle_source_new();
+    g_source_set_callback(source, func, this, nullptr);
+    const auto id = g_source_attach(source, engine_context);
+    g_source_unref(source);
+    return id;
+}
+
+void remove_engine_source(guint& id)
+{
+    if (id) {
+        if (auto source = g_main_context_find_source_by_id(engine_context, id))
+            g_source_destroy(source);
+        id = 0;
+    }
+}
+
+/* Queues a task behind everything already pending on the engine context;
+ * unlike g_main_context_invoke() it never runs inline, so it is safe to use
+ * from callbacks of the objects the task is going to destroy. */
+void post_engine_task(GSourceFunc func)
+{
+    add_engine_source(0, func);
+}
+
 gboolean cleanup_and_quit_loop (const gchar * msg, enum AppState state)
 {
     if (msg) {
@@ -329,16 +478,12 @@ gboolean cleanup_and_quit_loop (const gchar * msg, enum AppState state)
   if (state != APP_STATE_UNKNOWN)
     app_state = state;
 
-  if (webrtcbin_get_stats_id)
-    g_source_remove(webrtcbin_get_stats_id);
-  webrtcbin_get_stats_id = 0;
-
-  if (signaling_connection)
-    signaling_connection->close();
-
-  if (loop) {
-    g_main_loop_quit (loop);
-    g_clear_pointer (&loop, g_main_loop_unref);
+  {
+    std::lock_guard<std::mutex> lock(engine_mtx);
+    if (in_call) {
+      in_call = false;
+      post_engine_task(end_call);
+    }
   }
 
   if (p_sendrecv)
@@ -417,6 +562,19 @@ void handle_media_stream(GstPad* pad, GstElement* pipe, const char* convert_name
 }
 
 
+static GstPadProbeReturn
+first_decoded_frame_probe(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer user_data)
+{
+    auto self = static_cast<SendRecv*>(user_data);
+    self->mark_call_setup("first decoded frame");
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - self->answer_time).count();
+    gst_print("Time to first frame: %lld ms after answering (%s media source)\n",
+        static_cast<long long>(elapsed), self->media_source_warm ? "warm" : "cold");
+    return GST_PAD_PROBE_REMOVE;
+}
+
 static void
 on_incoming_decodebin_stream (GstElement * decodebin, GstPad * pad,
     gpointer user_data)
@@ -447,18 +605,27 @@ on_incoming_decodebin_stream (GstElement * decodebin, GstPad * pad,
   }
 
   if (g_str_has_prefix (name, "video")) {
-    auto sink = find_video_sink();
-    self->handle_media_stream (pad, self->pipe1, "videoconvert", sink);
-    gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (sink), self->xwinid);
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        first_decoded_frame_probe, self, nullptr);
+    if (g_settings.headless) {
+      self->handle_media_stream (pad, self->pipe1, "videoconvert", gst_element_factory_make("fakesink", nullptr));
+    } else {
+      auto sink = find_video_sink();
+      self->handle_media_stream (pad, self->pipe1, "videoconvert", sink);
+      gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (sink), self->xwinid);
+    }
   } else if (g_str_has_prefix (name, "audio")) {
-      self->handle_media_stream (pad, self->pipe1, "audioconvert", gst_element_factory_make("autoaudiosink", nullptr));
+      self->handle_media_stream (pad, self->pipe1, "audioconvert",
+          gst_element_factory_make(g_settings.headless ? "fakesink" : "autoaudiosink", nullptr));
   } else {
     gst_printerr ("Unknown pad %s, ignoring", GST_PAD_NAME (pad));
   }
 }
 
 
-GstElement* get_file_sink(GstBin* pipe)
+// The container is picked for the call's video codec, whichever stream
+// comes first.
+GstElement* get_file_sink(GstBin* pipe, const VideoCodec& video)
 {
     std::unique_lock<std::mutex> lock(mtx);
 
@@ -466,7 +633,8 @@ GstElement* get_file_sink(GstBin* pipe)
     if (auto result = gst_bin_get_by_name(pipe, file_sink_name))
         return result;
 
-    const char muxerName[] = "webmmux";
+    const char* muxerName = muxer_factory(video);
+    const char* extension = recording_extension(video);
 
     const int sliceDurationSecs = g_settings.slice_duration_secs;
     if (sliceDurationSecs > 0)
@@ -477,12 +645,14 @@ GstElement* get_file_sink(GstBin* pipe)
             nullptr);
         g_object_set(G_OBJECT(splitmuxsink),
             "async-finalize", TRUE,
+            // Slices can only start at keyframes, which the peer sends on request.
+            "send-keyframe-requests", TRUE,
             "max-size-time", GST_SECOND * sliceDurationSecs,
             "muxer-factory", muxerName,
             "muxer-properties", s,
             nullptr);
         g_signal_connect(splitmuxsink, "format-location-full",
-            G_CALLBACK(splitmuxsink_on_format_location_full), NULL);
+            G_CALLBACK(splitmuxsink_on_format_location_full), const_cast<char*>(extension));
 
         auto ok = gst_bin_add(GST_BIN(pipe), splitmuxsink);
         g_assert_true(ok);
@@ -504,7 +674,7 @@ GstElement* get_file_sink(GstBin* pipe)
     ok = gst_bin_add(GST_BIN(pipe), filesink);
     g_assert_true(ok);
 
-    auto nextfilename = prepare_next_file_name();
+    auto nextfilename = prepare_next_file_name(extension);
     g_object_set(G_OBJECT(filesink),
         "location", nextfilename,
         nullptr);
@@ -567,7 +737,7 @@ on_incoming_stream (GstElement * webrtc, GstPad * pad, gpointer user_data)
   g_free(str);
 
   // Add this to inspect structure content
-  bool is_vp8 = false;
+  const VideoCodec* video = nullptr;
   bool is_opus = false;
   if (g_settings.do_save)
   {
@@ -586,12 +756,12 @@ on_incoming_stream (GstElement * webrtc, GstPad * pad, gpointer user_data)
       g_print("Incoming encoding-name: %s\n", encoding_name ? encoding_name : "null");
 
       // Decide codec by name instead of hard-coded payload number.
-      // Treat VP8 as video, OPUS as audio.
-      is_vp8 = (encoding_name && g_str_equal(encoding_name, "VP8"));
+      // The registry's codecs are video, OPUS is audio.
+      video = find_video_codec(encoding_name);
       is_opus = (encoding_name && g_str_equal(encoding_name, "OPUS"));
   }
 
-  if (is_vp8 || is_opus)
+  if (video || is_opus)
   {
       auto tee = gst_element_factory_make("tee", nullptr);
       gst_bin_add(GST_BIN(self->pipe1), tee);
@@ -613,7 +783,7 @@ on_incoming_stream (GstElement * webrtc, GstPad * pad, gpointer user_data)
       }
 
       // pick depayper by codec name
-      const char* depay_name = is_vp8 ? "rtpvp8depay" : "rtpopusdepay";
+      const char* depay_name = video ? video->depayloader : "rtpopusdepay";
       auto depay = gst_element_factory_make(depay_name, nullptr);
       auto ok = gst_bin_add(GST_BIN(self->pipe1), depay);
       g_assert_true(ok);
@@ -626,17 +796,38 @@ on_incoming_stream (GstElement * webrtc, GstPad * pad, gpointer user_data)
       ok = gst_element_sync_state_with_parent(queue);
       g_assert_true(ok);
 
-      auto sink = self->get_file_sink(GST_BIN(self->pipe1));
+      // Both directions of the call use the video codec we send.
+      auto sink = self->get_file_sink(GST_BIN(self->pipe1), video ? *video : *self->video_codec);
 
-      if (is_vp8)
+      if (video)
       {
         self->last_video_pts = {};
 
         auto srcpad = gst_element_get_static_pad(depay, "src");
         gst_pad_add_probe(srcpad, GST_PAD_PROBE_TYPE_BUFFER, gst_pad_probe_callback, self, nullptr);
+        gst_object_unref(srcpad);
+
+        // Matroska wants H.264 and AV1 in their stream formats, not as depayloaded
+        if (video->parser)
+        {
+          auto parser = gst_element_factory_make(video->parser, nullptr);
+          ok = gst_bin_add(GST_BIN(self->pipe1), parser);
+          g_assert_true(ok);
+          ok = gst_element_sync_state_with_parent(parser);
+          g_assert_true(ok);
 
-        ok = gst_element_link_many(tee, depay, queue, nullptr);
+          ok = gst_element_link_many(tee, depay, parser, queue, nullptr);
+        }
+        else
+        {
+          ok = gst_element_link_many(tee, depay, queue, nullptr);
+        }
         g_assert_true(ok);
+
+        // The recording starts with a keyframe rather than at the next one.
+        auto depay_sinkpad = gst_element_get_static_pad(depay, "sink");
+        request_remote_keyframe(depay_sinkpad);
+        gst_object_unref(depay_sinkpad);
       }
       else // OPUS
       {
@@ -680,20 +871,116 @@ on_incoming_stream (GstElement * webrtc, GstPad * pad, gpointer user_data)
 }
 
 
+static bool
+is_host_or_srflx_candidate(const gchar* candidate)
+{
+    return strstr(candidate, " typ host") != nullptr || strstr(candidate, " typ srflx") != nullptr;
+}
+
 static void
 send_ice_candidate_message(GstElement * webrtc G_GNUC_UNUSED, guint mlineindex,
     gchar * candidate, gpointer user_data)
 {
     auto self = static_cast<SendRecv*>(user_data);
-    self->ice_candidates.emplace_back( mlineindex, candidate );
+    self->queue_ice_candidate(mlineindex, candidate);
+}
+
+// Called from webrtcbin's thread.
+void queue_ice_candidate(guint mlineindex, const gchar* candidate)
+{
+    std::lock_guard<std::mutex> lock(ice_mtx);
+
+    // Our agent pairs every local candidate, sent or not.
+    count_candidate(candidate, &CandidateCount::local);
+    if (ice_filter && !ice_filter->accept_local(candidate)) {
+        ++filtered_candidates;
+        return;
+    }
+
+    ice_candidates.emplace_back(mlineindex, candidate);
+
+    if (!g_settings.trickle_ice || !local_description_sent || ice_flush_id)
+        return;
+
+    // The first usable candidate goes out right away, so that the peer can start
+    // connectivity checks while we are still gathering; the rest are coalesced.
+    if (!first_candidate_sent && is_host_or_srflx_candidate(candidate))
+        ice_flush_id = add_engine_source(0, flush_ice_candidates);
+    else
+        ice_flush_id = add_engine_source(g_settings.ice_flush_interval_ms, flush_ice_candidates);
+}
+
+static gboolean
+flush_ice_candidates(gpointer user_data)
+{
+    auto self = static_cast<SendRecv*>(user_data);
+    {
+        std::lock_guard<std::mutex> lock(self->ice_mtx);
+        self->ice_flush_id = 0;
+    }
+    self->send_candidates();
+    return G_SOURCE_REMOVE;
 }
 
+void cancel_ice_flush()
+{
+    std::lock_guard<std::mutex> lock(ice_mtx);
+    remove_engine_source(ice_flush_id);
+}
+
+// Call with ice_mtx held.
+void count_candidate(const gchar* candidate, int CandidateCount::* side)
+{
+    IceCandidateInfo info;
+    if (!parse_ice_candidate(candidate, info))
+        return;
+    const bool ipv6 = info.address.find(':') != std::string::npos;
+    ++(candidate_counts[info.transport + (ipv6 ? "/ipv6" : "/ipv4")].*side);
+}
+
+/* The candidate pairs webrtcbin's stats list once ICE is connected */
+void report_candidate_pairs()
+{
+    if (!webrtc1)
+        return;
+    auto promise = gst_promise_new_with_change_func (on_candidate_pair_stats, this, nullptr);
+    g_signal_emit_by_name (webrtc1, "get-stats", NULL, promise);
+    gst_promise_unref (promise);
+}
+
+void print_candidate_pairs(int pairs)
+{
+    std::lock_guard<std::mutex> lock(ice_mtx);
+    int local = 0, remote = 0;
+    for (const auto& count : candidate_counts) {
+        local += count.second.local;
+        remote += count.second.remote;
+    }
+    gst_print("ICE connected with %d candidate pairs (%d local, %d remote candidates, %d filtered out)\n",
+        pairs, local, remote, filtered_candidates);
+}
 
 void send_candidates()
 {
+    decltype(ice_candidates) candidates;
+    {
+        std::lock_guard<std::mutex> lock(ice_mtx);
+        candidates.swap(ice_candidates);
+        if (!candidates.empty())
+            first_candidate_sent = true;
+
+        // Candidates of the preferred address family get checked first.
+        if (ice_filter)
+            std::stable_partition(candidates.begin(), candidates.end(),
+                [this](const std::pair<int, std::string>& c) { return ice_filter->preferred(c.second.c_str()); });
+    }
+
+    if (candidates.empty() || !signaling_connection)
+        return;
+
     auto ar = json_array_new();
 
-    for (const auto& candidate : ice_candidates)
+    for (const auto& candidate : candidates)
     {
         auto ice = json_object_new();
         json_object_set_string_member(ice, "candidate", candidate.second.c_str());
@@ -701,8 +988,6 @@ void send_candidates()
         json_array_add_object_element(ar, ice);
     }
 
-    ice_candidates.clear();
-
     auto msg = json_object_new();
     json_object_set_array_member(msg, "ice", ar);
     auto text = get_string_from_json_object(msg);
@@ -734,7 +1019,17 @@ void send_sdp_to_peer (GstWebRTCSessionDescription * desc)
     g_assert_not_reached ();
   }
 
-  json_object_set_string_member (sdp, "sdp", text);
+  std::string compact;
+  if (g_settings.compact_sdp
+      && signaling_connection->peer_has_capability (COMPACT_SDP_CAPABILITY))
+    compact = compact_sdp_encode (text);
+
+  if (!compact.empty ()) {
+    gst_print ("Compact SDP: %d -> %d bytes\n", (int) strlen (text), (int) compact.size ());
+    json_object_set_string_member (sdp, "zsdp", compact.c_str ());
+  } else {
+    json_object_set_string_member (sdp, "sdp", text);
+  }
   g_free (text);
 
   auto msg = json_object_new ();
@@ -744,6 +1039,13 @@ void send_sdp_to_peer (GstWebRTCSessionDescription * desc)
 
   signaling_connection->send_text(text);
   g_free (text);
+
+  /* Candidates may only follow our description; trickle whatever was
+   * gathered in the meantime. */
+  std::lock_guard<std::mutex> lock(ice_mtx);
+  local_description_sent = true;
+  if (g_settings.trickle_ice && !ice_candidates.empty() && !ice_flush_id)
+      ice_flush_id = add_engine_source(0, flush_ice_candidates);
 }
 
 /* Offer created by our pipeline, to be sent to the peer */
@@ -754,7 +1056,8 @@ on_offer_created (GstPromise * promise, gpointer user_data)
 
   GstWebRTCSessionDescription *offer = nullptr;
 
-  g_assert_cmphex (self->app_state, ==, PEER_CALL_NEGOTIATING);
+  if (!self->prebuilt)
+    g_assert_cmphex (self->app_state, ==, PEER_CALL_NEGOTIATING);
 
   g_assert_cmphex (gst_promise_wait (promise), ==, GST_PROMISE_RESULT_REPLIED);
   auto reply = gst_promise_get_reply (promise);
@@ -762,18 +1065,66 @@ on_offer_created (GstPromise * promise, gpointer user_data)
       GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, nullptr);
   gst_promise_unref (promise);
 
+  /* Gathering starts with the local description */
+  self->apply_ice_servers ();
+
   promise = gst_promise_new ();
   g_signal_emit_by_name (self->webrtc1, "set-local-description", offer, promise);
   gst_promise_interrupt (promise);
   gst_promise_unref (promise);
 
+  /* Not before the peer is authenticated; see start_pipeline() */
+  if (self->prebuilt) {
+    std::lock_guard<std::mutex> lock (self->fast_mtx);
+    if (!self->handshake_done) {
+      self->pending_offer = offer;
+      return;
+    }
+  }
+
   /* Send offer to peer */
   self->send_sdp_to_peer (offer);
   gst_webrtc_session_description_free (offer);
 }
 
+void maybe_create_offer ()
+{
+  {
+    std::lock_guard<std::mutex> lock (fast_mtx);
+    if (!is_offerer || !negotiation_needed || offer_requested)
+      return;
+    offer_requested = true;
+  }
+
+  GstPromise *promise =
+      gst_promise_new_with_change_func (on_offer_created, this, nullptr);
+  g_signal_emit_by_name (webrtc1, "create-offer", NULL, promise);
+}
+
+/* The first message from the peer settles who makes the offer */
+void on_peer_discovered ()
+{
+  if (!prebuilt || !signaling_connection || !signaling_connection->we_create_offer ())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock (fast_mtx);
+    is_offerer = true;
+  }
+  maybe_create_offer ();
+}
+
 void on_negotiation_needed (GstElement * element, bool create_offer)
 {
+  if (prebuilt) {
+    {
+      std::lock_guard<std::mutex> lock (fast_mtx);
+      negotiation_needed = true;
+    }
+    maybe_create_offer ();
+    return;
+  }
+
   app_state = PEER_CALL_NEGOTIATING;
 
   if (remote_is_offerer) {
@@ -799,9 +1150,58 @@ on_negotiation_needed_false(GstElement* element, gpointer user_data)
     self->on_negotiation_needed(element, false);
 }
 
-#define STUN_SERVER " stun-server=stun://stun.l.google.com:19302 "
+#define STUN_SERVER DEFAULT_STUN_SERVER
+
+#define ICE_RESTART_GRACE_MS 2000
+#define ICE_RESTART_RETRY_MS 5000
+#define MAX_ICE_RESTARTS 5
+
+static std::string
+turn_server_uri ()
+{
+  if (!g_settings.use_turn || g_settings.turn_server.empty ())
+    return {};
+  return "turn://" + g_settings.turn_server;
+}
+
+/* The policy parts the ICE agent itself can enforce */
+void
+configure_ice_agent ()
+{
+  {
+    std::lock_guard<std::mutex> lock (ice_mtx);
+    ice_filter = std::make_unique<IceCandidateFilter> (g_settings.ice_candidate_policy,
+        g_settings.ice_address_family, g_settings.ice_tcp,
+        g_settings.ice_allowed_networks, g_settings.ice_denied_networks);
+  }
+
+  if (!g_object_class_find_property (G_OBJECT_GET_CLASS (webrtc1), "ice-agent"))
+    return;
+
+  GObject *ice = nullptr;
+  g_object_get (webrtc1, "ice-agent", &ice, nullptr);
+  if (!ice)
+    return;
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (ice), "ice-tcp"))
+    g_object_set (ice, "ice-tcp", g_settings.ice_tcp ? TRUE : FALSE, nullptr);
+  g_object_unref (ice);
+}
+
+/* Points webrtcbin at the servers' resolved addresses, if they are known by
+ * now, so that gathering does not wait for DNS. */
+void
+apply_ice_servers ()
+{
+  /* Host candidates need no servers */
+  if (g_settings.ice_candidate_policy == IceCandidatePolicy::HostOnly)
+    return;
+
+  g_object_set (webrtc1, "stun-server", resolved_ice_server (STUN_SERVER).c_str (), nullptr);
+  const auto turn_server = turn_server_uri ();
+  if (!turn_server.empty ())
+    g_object_set (webrtc1, "turn-server", resolved_ice_server (turn_server).c_str (), nullptr);
+}
 #define RTP_CAPS_OPUS "application/x-rtp,media=audio,encoding-name=OPUS,payload="
-#define RTP_CAPS_VP8 "application/x-rtp,media=video,encoding-name=VP8,payload="
 
 static void
 data_channel_on_error (GObject * dc, gpointer user_data)
@@ -883,16 +1283,95 @@ on_ice_gathering_state_notify (GstElement * webrtcbin, GParamSpec * pspec,
       break;
     case GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE:
       new_state = "complete";
+      self->cancel_ice_flush();
       self->send_candidates();
       break;
   }
   gst_print ("ICE gathering state changed to %s\n", new_state);
 }
 
+/* Schedules an ICE restart 'grace_ms' from now, or sooner */
+void on_ice_lost(guint grace_ms)
+{
+    std::lock_guard<std::mutex> lock(ice_mtx);
+    if (ice_lost_time == std::chrono::steady_clock::time_point{})
+        ice_lost_time = std::chrono::steady_clock::now();
+
+    if (ice_restart_id) {
+        if (grace_ms)
+            return;
+        remove_engine_source(ice_restart_id);
+    }
+    ice_restart_id = add_engine_source(grace_ms, restart_ice);
+}
+
+/* Returns whether connectivity had been lost before */
+bool on_ice_recovered()
+{
+    std::lock_guard<std::mutex> lock(ice_mtx);
+    remove_engine_source(ice_restart_id);
+
+    if (ice_lost_time == std::chrono::steady_clock::time_point{})
+        return false;
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - ice_lost_time).count();
+    gst_print("ICE recovered after %lld ms (%d restarts)\n",
+        static_cast<long long>(elapsed), ice_restart_attempts);
+    ice_lost_time = {};
+    ice_restart_attempts = 0;
+    return true;
+}
+
+static gboolean
+restart_ice(gpointer user_data)
+{
+    auto self = static_cast<SendRecv*>(user_data);
+    if (!self->webrtc1 || !self->signaling_connection)
+        return G_SOURCE_REMOVE;
+
+    int attempt;
+    {
+        std::lock_guard<std::mutex> lock(self->ice_mtx);
+        self->ice_restart_id = 0;
+        attempt = ++self->ice_restart_attempts;
+    }
+
+    if (attempt > MAX_ICE_RESTARTS) {
+        self->cleanup_and_quit_loop("ICE restart: connectivity not restored, ending the call",
+            PEER_CALL_ERROR);
+        return G_SOURCE_REMOVE;
+    }
+
+    /* The answerer waits for the offerer's new offer, as long as the
+     * offerer would keep trying */
+    if (!self->signaling_connection->we_create_offer()) {
+        self->on_ice_lost(ICE_RESTART_RETRY_MS);
+        return G_SOURCE_REMOVE;
+    }
+
+    gst_print("ICE restart #%d\n", attempt);
+
+    /* Renegotiation only; the pipeline keeps running */
+    self->app_state = PEER_CALL_NEGOTIATING;
+
+    auto options = gst_structure_new("offer-options",
+        "ice-restart", G_TYPE_BOOLEAN, TRUE, nullptr);
+    auto promise = gst_promise_new_with_change_func(on_offer_created, self, nullptr);
+    g_signal_emit_by_name(self->webrtc1, "create-offer", options, promise);
+    gst_structure_free(options);
+
+    /* Retry if this one does not get us through either */
+    self->on_ice_lost(ICE_RESTART_RETRY_MS);
+    return G_SOURCE_REMOVE;
+}
+
 static void
 on_ice_connection_state_notify(GstElement * webrtcbin, GParamSpec * pspec,
     gpointer user_data)
 {
+    auto self = static_cast<SendRecv*>(user_data);
+
     GstWebRTCICEConnectionState ice_connection_state;
     const gchar *new_state = "unknown";
 
@@ -906,15 +1385,24 @@ on_ice_connection_state_notify(GstElement * webrtcbin, GParamSpec * pspec,
         break;
     case GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED:
         new_state = "connected";
+        if (!self->on_ice_recovered()) {
+            self->mark_call_setup("ICE connected");
+            self->ice_connected_time = std::chrono::steady_clock::now();
+            self->report_candidate_pairs();
+        }
         break;
     case GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED:
         new_state = "completed";
+        self->on_ice_recovered();
         break;
     case GST_WEBRTC_ICE_CONNECTION_STATE_FAILED:
         new_state = "failed";
+        self->on_ice_lost(0);
         break;
     case GST_WEBRTC_ICE_CONNECTION_STATE_DISCONNECTED:
         new_state = "disconnected";
+        /* Often just a few lost checks; give the agent a chance first */
+        self->on_ice_lost(ICE_RESTART_GRACE_MS);
         break;
     case GST_WEBRTC_ICE_CONNECTION_STATE_CLOSED:
         new_state = "closed";
@@ -938,6 +1426,32 @@ on_webrtcbin_stat (GQuark field_id, const GValue * value, gpointer unused)
   return TRUE;
 }
 
+static gboolean
+count_candidate_pair (GQuark /*field_id*/, const GValue * value, gpointer user_data)
+{
+  gint type;
+  if (GST_VALUE_HOLDS_STRUCTURE (value)
+      && gst_structure_get_enum (gst_value_get_structure (value), "type",
+          GST_TYPE_WEBRTC_STATS_TYPE, &type)
+      && type == GST_WEBRTC_STATS_CANDIDATE_PAIR)
+    ++*static_cast<int*>(user_data);
+
+  return TRUE;
+}
+
+static void
+on_candidate_pair_stats (GstPromise * promise, gpointer user_data)
+{
+  auto self = static_cast<SendRecv*>(user_data);
+
+  if (gst_promise_wait (promise) != GST_PROMISE_RESULT_REPLIED)
+    return;
+
+  int pairs = 0;
+  gst_structure_foreach (gst_promise_get_reply (promise), count_candidate_pair, &pairs);
+  self->print_candidate_pairs (pairs);
+}
+
 static void
 on_webrtcbin_get_stats (GstPromise * promise, void* user_data)
 {
@@ -948,14 +1462,24 @@ on_webrtcbin_get_stats (GstPromise * promise, void* user_data)
   auto stats = gst_promise_get_reply (promise);
   gst_structure_foreach (stats, on_webrtcbin_stat, nullptr);
 
-  self->webrtcbin_get_stats_id = g_timeout_add (100, (GSourceFunc) webrtcbin_get_stats, self);
+  auto sender = self->sender_stats ();
+  GST_DEBUG ("stat: \'sender\': %" GST_PTR_FORMAT, sender);
+  gst_structure_free (sender);
+
+  self->webrtcbin_get_stats_id = self->add_engine_source (100, webrtcbin_get_stats);
 }
 
 static gboolean
 webrtcbin_get_stats (void* user_data)
 {
     auto self = static_cast<SendRecv*>(user_data);
-    
+
+    /* The reply of the previous request may have rearmed us after hang-up */
+    if (!self->webrtc1) {
+      self->webrtcbin_get_stats_id = 0;
+      return G_SOURCE_REMOVE;
+    }
+
     GstPromise *promise =
       gst_promise_new_with_change_func (
       (GstPromiseChangeFunc) on_webrtcbin_get_stats, self, nullptr);
@@ -1032,115 +1556,685 @@ static gboolean bus_call(GstBus * /*bus*/, GstMessage *msg, void *user_data)
 
 #define RTP_TWCC_URI "http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01"
 
-gboolean
-start_pipeline (gboolean create_offer)
+/* How long a call may wait for the certificate cache on its first use */
+#define DTLS_CERTIFICATE_WAIT_MS 200
+
+static void
+on_dtls_key_set (GstElement * /*dtlssrtpenc*/, gpointer user_data)
 {
-   std::string turnServer;
-   if (g_settings.use_turn)
-   {
-       turnServer = g_settings.turn_server;
-       if (!turnServer.empty())
-       {
-           turnServer = " turn-server=turn://" + turnServer + ' ';
-       }
-   }
- 
-   const auto pipeline_description = "webrtcbin bundle-policy=max-bundle name=sendrecv "
-       STUN_SERVER + turnServer
-       + g_settings.video_launch_line +
-       " ! videoconvert ! queue ! "
-       // https://developer.ridgerun.com/wiki/index.php/GstKinesisWebRTC/Getting_Started/C_Example_Application
-       "vp8enc error-resilient=partitions keyframe-max-dist=10 deadline=1 ! "
-       // picture-id-mode=15-bit seems to make TWCC stats behave better
-       "rtpvp8pay name=videopay picture-id-mode=15-bit ! "
-       "queue ! " RTP_CAPS_VP8 "96 ! sendrecv. "
-       + g_settings.audio_launch_line +
-       " ! audioconvert ! audioresample ! queue ! opusenc ! rtpopuspay name=audiopay ! "
-       "queue ! " RTP_CAPS_OPUS "97 ! sendrecv. ";
-
-   GError *error = nullptr;
-   pipe1 = gst_parse_launch (pipeline_description.c_str(), &error);
-
-   if (!gst_bin_get_by_name(GST_BIN(pipe1), "videopay"))
-       g_printerr("videopay missing\n");
-
-   if (!gst_bin_get_by_name(GST_BIN(pipe1), "audiopay"))
-       g_printerr("audiopay missing\n");
-
-   if (error) {
-     gst_printerr ("Failed to parse launch: %s\n", error->message);
-     g_error_free (error);
-     goto err;
-   }
+  auto self = static_cast<SendRecv*>(user_data);
+  self->report_dtls_handshake ();
+}
 
-  // add bus call
-  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipe1));
-  gst_bus_add_watch(bus, bus_call, this);
-  gst_object_unref(bus);
+void
+report_dtls_handshake ()
+{
+  if (dtls_reported)
+    return;
+  dtls_reported = true;
 
-  webrtc1 = gst_bin_get_by_name (GST_BIN (pipe1), "sendrecv");
-  g_assert_nonnull (webrtc1);
+  /* Whatever was encoded before the keys were set never left */
+  request_keyframe ();
 
-  if (remote_is_offerer) {
-    /* XXX: this will fail when the remote offers twcc as the extension id
-     * cannot currently be negotiated when receiving an offer.
-     */
-    GST_FIXME ("Need to implement header extension negotiation when "
-        "reciving a remote offers");
-  } else {
+  mark_call_setup ("DTLS connected");
+  if (ice_connected_time != std::chrono::steady_clock::time_point{}) {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - ice_connected_time).count();
+    gst_print ("DTLS handshake: %lld ms after ICE connected (%s certificate)\n",
+        static_cast<long long>(elapsed), dtls_pem.empty () ? "generated" : "cached");
+  }
+}
 
-    auto lam = [this] (const gchar* name) {
-        auto videopay = gst_bin_get_by_name(GST_BIN(pipe1), name);
-        g_assert_nonnull(videopay);
-        auto video_twcc = gst_rtp_header_extension_create_from_uri(RTP_TWCC_URI);
-        g_assert_nonnull(video_twcc);
-        gst_rtp_header_extension_set_id(video_twcc, 1);
-        g_signal_emit_by_name(videopay, "add-extension", video_twcc);
-        g_clear_object(&video_twcc);
-        g_clear_object(&videopay);
-    };
+/* Gives the cached certificate to the DTLS decoders, which own it for both
+ * directions, and watches the encoders for the end of the handshake. */
+bool
+configure_dtls_element (GstElement * element)
+{
+  auto factory = gst_element_get_factory (element);
+  if (!factory)
+    return false;
 
-    lam("videopay");
-    lam("audiopay");
+  const auto name = gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory));
+  if (g_str_equal (name, "dtlssrtpdec")) {
+    if (!dtls_pem.empty ())
+      g_object_set (element, "pem", dtls_pem.c_str (), nullptr);
+    return true;
+  }
+  if (g_str_equal (name, "dtlssrtpenc")) {
+    g_signal_connect (element, "on-key-set", G_CALLBACK (on_dtls_key_set), this);
+    return true;
   }
+  return false;
+}
 
-  /* This is the gstwebrtc entry point where we create the offer and so on. It
-   * will be called when the pipeline goes to PLAYING. */
-  g_signal_connect (webrtc1, "on-negotiation-needed",
-      create_offer? G_CALLBACK (on_negotiation_needed_true) : G_CALLBACK(on_negotiation_needed_false),
-      this);
-  /* We need to transmit this ICE candidate to the browser via the websockets
-   * signalling server. Incoming ice candidates from the browser need to be
-   * added by us too, see on_server_message() */
-  g_signal_connect (webrtc1, "on-ice-candidate",
-      G_CALLBACK (send_ice_candidate_message), this);
-  g_signal_connect (webrtc1, "notify::ice-gathering-state",
-      G_CALLBACK (on_ice_gathering_state_notify), this);
-  g_signal_connect(webrtc1, "on-new-transceiver",
-      G_CALLBACK(on_new_transceiver), NULL);
-  g_signal_connect(webrtc1, "notify::ice-connection-state",
-      G_CALLBACK(on_ice_connection_state_notify), NULL);
+/* Lets the receiving side ask the peer for a keyframe when packets are lost
+ * or the decoder runs into errors, rather than waiting for the next one. */
+bool
+configure_keyframe_requests (GstElement * element)
+{
+  auto set_if_known = [element] (const char * property) {
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), property))
+      g_object_set (element, property, TRUE, nullptr);
+  };
 
-  gst_element_set_state (pipe1, GST_STATE_READY);
+  if (GST_IS_VIDEO_DECODER (element)) {
+    set_if_known ("automatic-request-sync-points");
+    return true;
+  }
 
-  GObject* send_channel = nullptr;
-  g_signal_emit_by_name (webrtc1, "create-data-channel", "channel", NULL,
-      &send_channel);
-  if (send_channel) {
-    gst_print ("Created data channel\n");
-    connect_data_channel_signals (send_channel);
+  auto factory = gst_element_get_factory (element);
+  if (!factory || !is_video_depayloader (gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory))))
+    return false;
+  set_if_known ("request-keyframe");
+  set_if_known ("wait-for-keyframe");
+  return true;
+}
 
-    if (p_sendrecv)
-    {
-        auto lam = [ptr = std::make_shared<GObjHandle>(send_channel)](const std::string& s) {
-            if (s.empty())
-                return;
-            if (auto obj = ptr->get())
-                g_signal_emit_by_name(obj.get(), "send-string", s.c_str());
-        };
+bool
+configure_element (GstElement * element)
+{
+  return configure_dtls_element (element) || configure_keyframe_requests (element);
+}
 
-        std::function<void()> unregister;
-        if (p_sendrecv) {
+static void
+on_deep_element_added (GstBin * /*pipeline*/, GstBin * /*sub_bin*/,
+    GstElement * element, gpointer user_data)
+{
+  auto self = static_cast<SendRecv*>(user_data);
+  if (self->configure_element (element) || !GST_IS_BIN (element))
+    return;
+
+  /* Transport bins arrive with their DTLS elements already inside */
+  auto it = gst_bin_iterate_recurse (GST_BIN (element));
+  gst_iterator_foreach (it, [] (const GValue * item, gpointer user_data) {
+        auto self = static_cast<SendRecv*>(user_data);
+        self->configure_element (GST_ELEMENT (g_value_get_object (item)));
+      }, self);
+  gst_iterator_free (it);
+}
+
+/* Congestion control: webrtcbin runs the outgoing RTP through rtpgccbwe,
+ * which estimates from the TWCC feedback what the path can carry. Audio is
+ * given its share first, the video encoder gets what is left. */
+#define VIDEO_START_BITRATE 800000
+#define VIDEO_MIN_BITRATE 150000
+#define VIDEO_MAX_BITRATE 4000000
+/* RTP, UDP and IP headers of the audio stream at 50 packets a second */
+#define AUDIO_OVERHEAD_BITRATE 20000
+/* Smaller changes are not worth retuning the encoder for */
+#define BITRATE_UPDATE_PERCENT 5
+/* With temporal layers, the encoder bitrate below which layers are left out
+ * instead of lowering the quality of every frame further */
+#define TEMPORAL_LAYER_MIN_BITRATE 400000
+
+static void
+on_estimated_bitrate (GObject * bwe, GParamSpec * /*pspec*/, gpointer user_data)
+{
+  auto self = static_cast<SendRecv*>(user_data);
+  guint estimate = 0;
+  g_object_get (bwe, "estimated-bitrate", &estimate, nullptr);
+  self->apply_bandwidth_estimate (estimate);
+}
+
+static GstElement *
+on_request_aux_sender (GstElement * /*webrtc*/, GObject * /*dtls_transport*/, gpointer user_data)
+{
+  auto self = static_cast<SendRecv*>(user_data);
+  return self->create_bandwidth_estimator ();
+}
+
+GstElement *
+create_bandwidth_estimator ()
+{
+  auto bwe = gst_element_factory_make ("rtpgccbwe", nullptr);
+  if (!bwe) {
+    gst_print ("rtpgccbwe is not available, sending without congestion control\n");
+    return nullptr;
+  }
+
+  if (!video_encoder)
+    video_encoder = gst_bin_get_by_name (GST_BIN (pipe1), "videoenc");
+
+  gint audio_bitrate = 0;
+  if (auto audio_encoder = gst_bin_get_by_name (GST_BIN (pipe1), "audioenc")) {
+    g_object_get (audio_encoder, "bitrate", &audio_bitrate, nullptr);
+    gst_object_unref (audio_encoder);
+  }
+  audio_reserve = static_cast<guint> (audio_bitrate) + AUDIO_OVERHEAD_BITRATE;
+
+  /* A parked encoder still runs at the last call's rate */
+  video_target_bitrate = 0;
+  temporal_layers_sent = temporal_layers;
+  apply_bandwidth_estimate (audio_reserve + VIDEO_START_BITRATE);
+
+  g_object_set (bwe,
+      "min-bitrate", audio_reserve + VIDEO_MIN_BITRATE,
+      "max-bitrate", audio_reserve + VIDEO_MAX_BITRATE,
+      "estimated-bitrate", audio_reserve + VIDEO_START_BITRATE,
+      nullptr);
+  g_signal_connect (bwe, "notify::estimated-bitrate", G_CALLBACK (on_estimated_bitrate), this);
+
+  gst_print ("Congestion control: %u kbps reserved for audio\n", audio_reserve / 1000);
+  return bwe;
+}
+
+void
+apply_bandwidth_estimate (guint estimate)
+{
+  estimated_bitrate = estimate;
+
+  const guint available = estimate > audio_reserve ? estimate - audio_reserve : 0;
+  guint target = std::clamp<guint> (available, VIDEO_MIN_BITRATE, VIDEO_MAX_BITRATE);
+
+  if (temporal_layers > 1) {
+    const auto layering = temporal_layer_target (temporal_layers, temporal_layers_sent, available,
+        TEMPORAL_LAYER_MIN_BITRATE, VIDEO_MIN_BITRATE, VIDEO_MAX_BITRATE);
+    target = layering.encoder_bitrate;
+    if (temporal_layers_sent.exchange (layering.layers_sent) != layering.layers_sent)
+      gst_print ("Temporal layers: sending %d of %d\n", layering.layers_sent, temporal_layers);
+  }
+
+  const guint current = video_target_bitrate;
+  const guint change = target > current ? target - current : current - target;
+  if (current && change * 100ull < current * static_cast<guint64> (BITRATE_UPDATE_PERCENT))
+    return;
+
+  video_target_bitrate = target;
+  if (video_encoder && temporal_layers > 1)
+    set_temporal_layer_bitrates (video_encoder, temporal_layers, target);
+  else if (video_encoder && video_encoder_spec)
+    g_object_set (video_encoder, video_encoder_spec->bitrate_property,
+        static_cast<gint> (target / video_encoder_spec->bitrate_divisor), nullptr);
+
+  GST_DEBUG ("bandwidth estimate %u bps, video target %u bps", estimate, target);
+
+  /* Only the big moves, the rest is in the stats */
+  if (!reported_bitrate || target * 4ull < reported_bitrate * 3ull || target * 3ull > reported_bitrate * 4ull) {
+    reported_bitrate = target;
+    gst_print ("Bandwidth estimate: %u kbps, video at %u kbps\n", estimate / 1000, target / 1000);
+  }
+}
+
+/* The bandwidth, keyframes and encoding of what we send, alongside
+ * webrtcbin's stats */
+GstStructure *
+sender_stats ()
+{
+  auto stats = gst_structure_new ("sender-stats",
+      "estimated-bitrate", G_TYPE_UINT, estimated_bitrate.load (),
+      "video-target-bitrate", G_TYPE_UINT, video_target_bitrate.load (),
+      "audio-reserve-bitrate", G_TYPE_UINT, audio_reserve,
+      "temporal-layers", G_TYPE_INT, temporal_layers,
+      "temporal-layers-sent", G_TYPE_INT, temporal_layers_sent.load (),
+      "layer-dropped-frames", G_TYPE_UINT, layer_dropped_frames.load (),
+      nullptr);
+
+  std::lock_guard<std::mutex> lock (keyframe_mtx);
+  gst_structure_set (stats,
+      "keyframes", G_TYPE_UINT, keyframes,
+      "keyframe-bytes", G_TYPE_UINT64, keyframe_bytes,
+      "keyframe-requests", G_TYPE_UINT, keyframe_requests,
+      "keyframe-requests-deferred", G_TYPE_UINT, keyframe_requests_deferred,
+      nullptr);
+
+  const auto encoding = encode_latency.summary ();
+  gst_structure_set (stats,
+      "encoded-frames", G_TYPE_UINT, encoding.frames,
+      "encode-fps", G_TYPE_DOUBLE, encoding.fps,
+      "encode-latency-average-ms", G_TYPE_DOUBLE, encoding.average_ms,
+      "encode-latency-p95-ms", G_TYPE_DOUBLE, encoding.p95_ms,
+      nullptr);
+  return stats;
+}
+
+/* Keyframes are forced on request only: picture loss reported by the peer
+ * (PLI/FIR, which rtpbin turns into force-key-unit events), a recording
+ * starting on its side, and the start of the media flow. A keyframe every
+ * KEYFRAME_MAX_DIST frames remains as a safety net. */
+#define KEYFRAME_MAX_DIST 3000
+#define KEYFRAME_MIN_INTERVAL_MS 500
+
+/* On the encoder's src pad: lets through at most one keyframe request per
+ * interval; a request coming too soon is replayed once the interval is over. */
+static GstPadProbeReturn
+keyframe_request_probe (GstPad * /*pad*/, GstPadProbeInfo * info, gpointer user_data)
+{
+  auto event = GST_PAD_PROBE_INFO_EVENT (info);
+  if (!gst_video_event_is_force_key_unit (event))
+    return GST_PAD_PROBE_OK;
+
+  auto self = static_cast<SendRecv*>(user_data);
+  return self->allow_keyframe_request (event) ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+bool
+allow_keyframe_request (GstEvent * event)
+{
+  std::lock_guard<std::mutex> lock (keyframe_mtx);
+
+  const bool replayed = gst_event_get_seqnum (event) == replayed_request_seqnum;
+  if (!replayed)
+    ++keyframe_requests;
+
+  const auto now = std::chrono::steady_clock::now ();
+  if (replayed || now - last_forced_keyframe >= std::chrono::milliseconds (KEYFRAME_MIN_INTERVAL_MS)) {
+    last_forced_keyframe = now;
+    keyframe_request_deferred = false;
+    return true;
+  }
+
+  if (!keyframe_request_deferred) {
+    keyframe_request_deferred = true;
+    ++keyframe_requests_deferred;
+  }
+  return false;
+}
+
+/* The deferred keyframe request, if its time has come */
+GstEvent *
+take_deferred_keyframe_request ()
+{
+  std::lock_guard<std::mutex> lock (keyframe_mtx);
+  if (!keyframe_request_deferred || std::chrono::steady_clock::now () - last_forced_keyframe
+      < std::chrono::milliseconds (KEYFRAME_MIN_INTERVAL_MS))
+    return nullptr;
+
+  auto event = gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0);
+  replayed_request_seqnum = gst_event_get_seqnum (event);
+  return event;
+}
+
+static GstPadProbeReturn
+encoded_frame_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  auto self = static_cast<SendRecv*>(user_data);
+
+  auto buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    std::lock_guard<std::mutex> lock (self->keyframe_mtx);
+    ++self->keyframes;
+    self->keyframe_bytes += gst_buffer_get_size (buffer);
+  }
+
+  if (auto event = self->take_deferred_keyframe_request ())
+    gst_pad_send_event (pad, event);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Asks our encoder for a keyframe, subject to the rate limit */
+void
+request_keyframe ()
+{
+  if (!pipe1)
+    return;
+  if (auto encoder = gst_bin_get_by_name (GST_BIN (pipe1), "videoenc")) {
+    gst_element_send_event (encoder,
+        gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0));
+    gst_object_unref (encoder);
+  }
+}
+
+/* Asks the peer for a keyframe through RTCP: rtpbin turns an upstream
+ * force-key-unit event into a PLI or FIR */
+static void
+request_remote_keyframe (GstPad * sinkpad)
+{
+  gst_pad_push_event (sinkpad,
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0));
+}
+
+/* On the encoder's src pad: leaves out the frames of the temporal layers
+ * above those the bandwidth estimate allows. Before the payloader, so that
+ * the receiver sees no gap in the sequence numbers, only a lower frame rate.
+ * Keyframes always pass: a forced one may come tagged with any layer, and
+ * everything after it refers to it. */
+static GstPadProbeReturn
+temporal_layer_probe (GstPad * /*pad*/, GstPadProbeInfo * info, gpointer user_data)
+{
+  auto self = static_cast<SendRecv*>(user_data);
+  auto buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)
+      || temporal_layer_of (buffer) < self->temporal_layers_sent)
+    return GST_PAD_PROBE_OK;
+
+  ++self->layer_dropped_frames;
+  return GST_PAD_PROBE_DROP;
+}
+
+/* On the pad feeding the encoder: sizes its parallelism for the frames
+ * about to come, before it is configured for them */
+static GstPadProbeReturn
+encoder_caps_probe (GstPad * pad, GstPadProbeInfo * info, gpointer /*user_data*/)
+{
+  auto event = GST_PAD_PROBE_INFO_EVENT (info);
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+
+  GstCaps *caps = nullptr;
+  gst_event_parse_caps (event, &caps);
+  gint width = 0, height = 0;
+  auto structure = gst_caps_get_structure (caps, 0);
+  if (!gst_structure_get_int (structure, "width", &width)
+      || !gst_structure_get_int (structure, "height", &height))
+    return GST_PAD_PROBE_OK;
+
+  auto peer = gst_pad_get_peer (pad);
+  if (!peer)
+    return GST_PAD_PROBE_OK;
+  auto encoder = gst_pad_get_parent_element (peer);
+  gst_object_unref (peer);
+  if (!encoder)
+    return GST_PAD_PROBE_OK;
+
+  VideoEncoderOverrides overrides;
+  overrides.threads = g_settings.encoder_threads;
+  overrides.token_partitions = g_settings.encoder_token_partitions;
+  overrides.speed = g_settings.encoder_speed;
+
+  const auto cores = g_get_num_processors ();
+  const auto tuning = resolve_encoder_tuning (cores, width, height, overrides);
+  apply_encoder_tuning (encoder, tuning);
+
+  auto factory = gst_element_get_factory (encoder);
+  gst_print ("%s for %dx%d on %u cores: %s\n",
+      factory ? gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)) : "Video encoder",
+      width, height, cores, describe_encoder_tuning (tuning).c_str ());
+  gst_object_unref (encoder);
+  return GST_PAD_PROBE_OK;
+}
+
+static std::string
+media_source_key (const VideoCodec & codec, int payload_type)
+{
+  return g_settings.video_launch_line + '\n' + g_settings.audio_launch_line
+      + '\n' + rtp_caps (codec, payload_type) + '\n' + std::to_string (g_settings.temporal_layers);
+}
+
+/* Capture and encoders of both streams in one bin, exposing the RTP streams
+ * as "video_src" and "audio_src". Everything a call needs but webrtcbin. */
+GstElement *
+build_media_source (const VideoCodec & codec, int payload_type)
+{
+  auto encoder = available_encoder (codec);
+  if (!encoder) {
+    gst_printerr ("Failed to build the media source: no %s encoder installed\n", codec.encoding_name);
+    return nullptr;
+  }
+
+  auto encoder_spec = encoder->spec;
+  encoder_spec.name = "videoenc";
+  // Long GOP: keyframes come on request (see keyframe_request_probe)
+  encoder_spec.set (encoder->keyframe_distance_property, std::to_string (KEYFRAME_MAX_DIST));
+  encoder_spec.set (encoder->bitrate_property, std::to_string (VIDEO_START_BITRATE / encoder->bitrate_divisor));
+
+  const int layers = encoder_spec.factory == "vp8enc"
+      ? std::clamp (g_settings.temporal_layers, 1, static_cast<int> (MAX_TEMPORAL_LAYERS)) : 1;
+  if (layers > 1)
+    set_temporal_layers (encoder_spec, layers, VIDEO_START_BITRATE);
+
+  auto payloader_spec = codec.payloader;
+  payloader_spec.name = "videopay";
+
+  PipelineBuilder builder ("media_source");
+
+  auto& video = builder.branch ("video_src")
+      .source (g_settings.video_launch_line)
+      .convert (ElementSpec ("videoconvert"))
+      .convert (ElementSpec ("queue"))
+      .probe (GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, encoder_caps_probe, nullptr)
+      .probe (GST_PAD_PROBE_TYPE_BUFFER, EncodeLatencyMeter::input_probe, &encode_latency)
+      .encode (encoder_spec)
+      .probe (GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, keyframe_request_probe, this)
+      .probe (GST_PAD_PROBE_TYPE_BUFFER, encoded_frame_probe, this)
+      .probe (GST_PAD_PROBE_TYPE_BUFFER, EncodeLatencyMeter::output_probe, &encode_latency)
+      .probe (GST_PAD_PROBE_TYPE_BUFFER, temporal_layer_probe, this);
+  if (encoder->output_caps)
+    video.encode (ElementSpec ("capsfilter").set ("caps", encoder->output_caps));
+  video.payload (payloader_spec)
+      .payload (ElementSpec ("queue"))
+      .caps (rtp_caps (codec, payload_type));
+
+  builder.branch ("audio_src")
+      .source (g_settings.audio_launch_line)
+      .convert (ElementSpec ("audioconvert"))
+      .convert (ElementSpec ("audioresample"))
+      .convert (ElementSpec ("queue"))
+      .encode (ElementSpec ("opusenc", "audioenc"))
+      .payload (ElementSpec ("rtpopuspay", "audiopay"))
+      .payload (ElementSpec ("queue"))
+      .caps (RTP_CAPS_OPUS "97");
+
+  auto bin = builder.build ();
+  if (!bin) {
+    gst_printerr ("Failed to build the media source: %s\n", builder.error ().c_str ());
+    return nullptr;
+  }
+  gst_print ("Media source built with %s (%s): %s\n", codec.encoding_name,
+      encoder->spec.factory.c_str (), builder.timings_summary ().c_str ());
+
+  video_codec = &codec;
+  video_encoder_spec = encoder;
+  temporal_layers = layers;
+  temporal_layers_sent = layers;
+  if (layers > 1)
+    gst_print ("VP8 temporal layers: %d\n", layers);
+
+  if (remote_is_offerer) {
+    /* XXX: this will fail when the remote offers twcc as the extension id
+     * cannot currently be negotiated when receiving an offer.
+     */
+    GST_FIXME ("Need to implement header extension negotiation when "
+        "reciving a remote offers");
+  } else {
+
+    auto lam = [bin] (const gchar* name) {
+        auto videopay = gst_bin_get_by_name(GST_BIN(bin), name);
+        g_assert_nonnull(videopay);
+        auto video_twcc = gst_rtp_header_extension_create_from_uri(RTP_TWCC_URI);
+        g_assert_nonnull(video_twcc);
+        gst_rtp_header_extension_set_id(video_twcc, 1);
+        g_signal_emit_by_name(videopay, "add-extension", video_twcc);
+        g_clear_object(&video_twcc);
+        g_clear_object(&videopay);
+    };
+
+    lam("videopay");
+    lam("audiopay");
+  }
+
+  return bin;
+}
+
+/* Hands out (with a full reference) the parked media source if it was built
+ * from the current launch lines and preferred video codec, or a freshly
+ * built one. */
+GstElement *
+take_media_source ()
+{
+  auto codec = preferred_video_codecs (g_settings.video_codecs).front ();
+  const auto key = media_source_key (*codec, codec->payload_type);
+
+  auto source = media_source;
+  media_source = nullptr;
+  if (source && (!g_settings.warm_standby || media_source_description != key)) {
+    gst_element_set_state (source, GST_STATE_NULL);
+    gst_object_unref (source);
+    source = nullptr;
+  }
+
+  media_source_warm = source != nullptr;
+  if (!source) {
+    source = build_media_source (*codec, codec->payload_type);
+    if (!source)
+      return nullptr;
+    media_source_description = key;
+  }
+
+  gst_print ("Media source: %s\n", media_source_warm ? "warm standby" : "built for this call");
+  return source;
+}
+
+/* Takes the media source out of the finished call's pipeline and keeps it in
+ * READY, so that the device stays open and the next call skips building it. */
+void
+park_media_source ()
+{
+  if (!g_settings.warm_standby)
+    return;
+
+  auto source = gst_bin_get_by_name (GST_BIN (pipe1), "media_source");
+  if (!source)
+    return;
+
+  gst_element_set_state (pipe1, GST_STATE_READY);
+
+  for (auto pad_name : { "video_src", "audio_src" }) {
+    auto pad = gst_element_get_static_pad (source, pad_name);
+    if (auto peer = gst_pad_get_peer (pad)) {
+      gst_pad_unlink (pad, peer);
+      gst_object_unref (peer);
+    }
+    gst_object_unref (pad);
+  }
+
+  gst_bin_remove (GST_BIN (pipe1), source);
+
+  if (gst_element_set_state (source, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+    gst_element_set_state (source, GST_STATE_NULL);
+    gst_object_unref (source);
+    return;
+  }
+
+  media_source = source;
+  gst_print ("Media source parked in READY\n");
+}
+
+void
+drop_media_source ()
+{
+  if (media_source) {
+    gst_element_set_state (media_source, GST_STATE_NULL);
+    gst_object_unref (media_source);
+    media_source = nullptr;
+  }
+}
+
+gboolean
+start_pipeline (gboolean create_offer)
+{
+  if (prebuilt && pipe1) {
+    /* Handshake done: release or create the offer */
+    if (create_offer)
+      app_state = PEER_CALL_NEGOTIATING;
+
+    GstWebRTCSessionDescription *offer = nullptr;
+    {
+      std::lock_guard<std::mutex> lock (fast_mtx);
+      handshake_done = true;
+      is_offerer = create_offer;
+      std::swap (offer, pending_offer);
+    }
+
+    if (offer) {
+      send_sdp_to_peer (offer);
+      gst_webrtc_session_description_free (offer);
+    } else {
+      maybe_create_offer ();
+    }
+    return TRUE;
+  }
+
+  {
+    auto source = take_media_source ();
+    if (!source)
+      goto err;
+
+    ElementSpec webrtc_spec ("webrtcbin", "sendrecv");
+    webrtc_spec.set ("bundle-policy", "max-bundle");
+    if (g_settings.ice_candidate_policy != IceCandidatePolicy::HostOnly) {
+      webrtc_spec.set ("stun-server", resolved_ice_server (STUN_SERVER));
+      const auto turn_server = turn_server_uri ();
+      if (!turn_server.empty ())
+        webrtc_spec.set ("turn-server", resolved_ice_server (turn_server));
+    }
+    if (g_settings.ice_candidate_policy == IceCandidatePolicy::RelayOnly)
+      webrtc_spec.set ("ice-transport-policy", "relay");
+
+    std::string error;
+    webrtc1 = build_element (webrtc_spec, error);
+    if (!webrtc1) {
+      gst_printerr ("Failed to create webrtcbin: %s\n", error.c_str ());
+      gst_object_unref (source);
+      goto err;
+    }
+
+    pipe1 = gst_pipeline_new (nullptr);
+
+    /* webrtcbin creates its DTLS transports while negotiating */
+    dtls_pem = g_settings.dtls_certificate_path.empty () ? std::string ()
+        : get_dtls_certificate (std::chrono::milliseconds (DTLS_CERTIFICATE_WAIT_MS));
+    g_signal_connect (pipe1, "deep-element-added", G_CALLBACK (on_deep_element_added), this);
+
+    configure_ice_agent ();
+
+    g_signal_connect (webrtc1, "request-aux-sender", G_CALLBACK (on_request_aux_sender), this);
+
+    gst_bin_add_many (GST_BIN (pipe1), source, webrtc1, nullptr);
+    gst_object_unref (source);
+    if (!gst_element_link_pads (source, "video_src", webrtc1, "sink_%u")
+        || !gst_element_link_pads (source, "audio_src", webrtc1, "sink_%u")) {
+      gst_printerr ("Failed to link the media source to webrtcbin\n");
+      goto err;
+    }
+    set_video_codec_preferences (offered_video_caps ());
+  }
+
+  // add bus call
+  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipe1));
+  gst_bus_add_watch(bus, bus_call, this);
+  gst_object_unref(bus);
+
+  webrtc1 = gst_bin_get_by_name (GST_BIN (pipe1), "sendrecv");
+  g_assert_nonnull (webrtc1);
+
+  /* This is the gstwebrtc entry point where we create the offer and so on. It
+   * will be called when the pipeline goes to PLAYING. */
+  g_signal_connect (webrtc1, "on-negotiation-needed",
+      create_offer? G_CALLBACK (on_negotiation_needed_true) : G_CALLBACK(on_negotiation_needed_false),
+      this);
+  /* We need to transmit this ICE candidate to the browser via the websockets
+   * signalling server. Incoming ice candidates from the browser need to be
+   * added by us too, see on_server_message() */
+  g_signal_connect (webrtc1, "on-ice-candidate",
+      G_CALLBACK (send_ice_candidate_message), this);
+  g_signal_connect (webrtc1, "notify::ice-gathering-state",
+      G_CALLBACK (on_ice_gathering_state_notify), this);
+  g_signal_connect(webrtc1, "on-new-transceiver",
+      G_CALLBACK(on_new_transceiver), NULL);
+  g_signal_connect(webrtc1, "notify::ice-connection-state",
+      G_CALLBACK(on_ice_connection_state_notify), this);
+
+  gst_element_set_state (pipe1, GST_STATE_READY);
+
+  GObject* send_channel = nullptr;
+  g_signal_emit_by_name (webrtc1, "create-data-channel", "channel", NULL,
+      &send_channel);
+  if (send_channel) {
+    gst_print ("Created data channel\n");
+    connect_data_channel_signals (send_channel);
+
+    if (p_sendrecv)
+    {
+        auto lam = [ptr = std::make_shared<GObjHandle>(send_channel)](const std::string& s) {
+            if (s.empty())
+                return;
+            if (auto obj = ptr->get())
+                g_signal_emit_by_name(obj.get(), "send-string", s.c_str());
+        };
+
+        std::function<void()> unregister;
+        if (p_sendrecv) {
             unregister = p_sendrecv->setSendLambda(std::move(lam));
         }
         if (unregister) {
@@ -1162,7 +2256,7 @@ start_pipeline (gboolean create_offer)
   /* Lifetime is the same as the pipeline itself */
   gst_object_unref (webrtc1);
 
-  webrtcbin_get_stats_id = g_timeout_add (100, (GSourceFunc) webrtcbin_get_stats, this);
+  webrtcbin_get_stats_id = add_engine_source (100, webrtcbin_get_stats);
 
   gst_print ("Starting pipeline\n");
   auto ret = gst_element_set_state(pipe1, GST_STATE_PLAYING);
@@ -1250,6 +2344,9 @@ on_answer_created (GstPromise * promise, gpointer user_data)
       GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, nullptr);
   gst_promise_unref (promise);
 
+  /* Gathering starts with the local description */
+  self->apply_ice_servers ();
+
   promise = gst_promise_new ();
   g_signal_emit_by_name (self->webrtc1, "set-local-description", answer, promise);
   gst_promise_interrupt (promise);
@@ -1258,6 +2355,8 @@ on_answer_created (GstPromise * promise, gpointer user_data)
   /* Send answer to peer */
   self->send_sdp_to_peer (answer);
   gst_webrtc_session_description_free (answer);
+
+  self->mark_call_setup ("offer/answer");
 }
 
 static void
@@ -1270,21 +2369,278 @@ on_offer_set (GstPromise * promise, gpointer user_data)
   g_signal_emit_by_name (self->webrtc1, "create-answer", NULL, promise);
 }
 
-void on_offer_received (GstSDPMessage * sdp)
+/* How long an offer waits for a switched media source to start */
+#define DEFERRED_OFFER_TIMEOUT_MS 2000
+
+/* The video transceiver's codec-preferences: webrtcbin offers exactly these,
+ * and answers with what they share with the offer. Our video is linked
+ * first, so its transceiver is the first one. */
+void
+set_video_codec_preferences (const std::string & caps_string)
+{
+  GstWebRTCRTPTransceiver *transceiver = nullptr;
+  g_signal_emit_by_name (webrtc1, "get-transceiver", 0, &transceiver);
+  if (!transceiver) {
+    gst_printerr ("No video transceiver to set the codec preferences on\n");
+    return;
+  }
+  auto caps = gst_caps_from_string (caps_string.c_str ());
+  g_object_set (transceiver, "codec-preferences", caps, nullptr);
+  gst_caps_unref (caps);
+  gst_object_unref (transceiver);
+  video_codec_preferences = caps_string;
+}
+
+/* RTP caps of a codec we send, with the TWCC extension our payloaders add */
+static std::string
+sent_video_caps (const VideoCodec & codec, int payload_type)
+{
+  return rtp_caps (codec, payload_type) + ",extmap-1=(string)" RTP_TWCC_URI;
+}
+
+/* What we offer: every available codec, in the order of preference, each
+ * with its own payload type */
+static std::string
+offered_video_caps ()
+{
+  std::string caps;
+  for (auto codec : preferred_video_codecs (g_settings.video_codecs)) {
+    if (!caps.empty ())
+      caps += ';';
+    caps += sent_video_caps (*codec, codec->payload_type);
+  }
+  return caps;
+}
+
+static GstPadProbeReturn
+switched_source_flowing_probe (GstPad * /*pad*/, GstPadProbeInfo * /*info*/, gpointer user_data)
+{
+  auto self = static_cast<SendRecv*>(user_data);
+  self->post_engine_task (apply_deferred_offer);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Engine task, from the probe above or the timeout */
+static gboolean
+apply_deferred_offer (gpointer user_data)
+{
+  auto self = static_cast<SendRecv*>(user_data);
+  self->remove_engine_source (self->deferred_offer_id);
+  if (auto offer = std::exchange (self->deferred_offer, nullptr)) {
+    self->set_remote_offer (offer);
+    gst_webrtc_session_description_free (offer);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+void
+drop_deferred_offer ()
+{
+  remove_engine_source (deferred_offer_id);
+  if (deferred_offer)
+    gst_webrtc_session_description_free (deferred_offer);
+  deferred_offer = nullptr;
+}
+
+enum class CodecSwitch
+{
+  Switched,   /* the new source is linked and started */
+  Kept,       /* it could not be; the old source is sending again */
+  Failed,     /* neither could be put in place, the call is ended */
+};
+
+/* Links a media source's video and audio pads to webrtcbin's sink pads */
+static bool
+link_media_source (GstElement * source, GstPad * sinkpads[2])
+{
+  const char *pad_names[] = { "video_src", "audio_src" };
+  bool ok = true;
+  for (int i = 0; i < 2 && ok; i++) {
+    auto pad = gst_element_get_static_pad (source, pad_names[i]);
+    ok = sinkpads[i] && gst_pad_link (pad, sinkpads[i]) == GST_PAD_LINK_OK;
+    gst_object_unref (pad);
+  }
+  return ok;
+}
+
+static void
+unlink_media_source (GstElement * source)
+{
+  for (auto name : { "video_src", "audio_src" }) {
+    auto pad = gst_element_get_static_pad (source, name);
+    if (auto peer = gst_pad_get_peer (pad)) {
+      gst_pad_unlink (pad, peer);
+      gst_object_unref (peer);
+    }
+    gst_object_unref (pad);
+  }
+}
+
+/* Replaces the media source with one sending the given codec. The old source
+ * is stopped first, to free the camera for the new one, but only destroyed
+ * once the new one is linked and started; until then it can be put back.
+ * With an offer, the offer waits for the new source's first buffer, so that
+ * webrtcbin has its caps by the time it answers. */
+CodecSwitch
+switch_video_codec (const VideoCodec & codec, int payload_type, GstWebRTCSessionDescription * offer)
+{
+  /* A newer offer replaces one still waiting */
+  drop_deferred_offer ();
+
+  auto old_source = gst_bin_get_by_name (GST_BIN (pipe1), "media_source");
+  if (!old_source) {
+    cleanup_and_quit_loop ("ERROR: no media source in the pipeline", PEER_CALL_ERROR);
+    return CodecSwitch::Failed;
+  }
+
+  const auto old_codec = video_codec;
+  const auto old_encoder_spec = video_encoder_spec;
+  const auto old_layers = temporal_layers;
+
+  auto source = build_media_source (codec, payload_type);
+  if (!source) {
+    gst_object_unref (old_source);
+    return CodecSwitch::Kept;
+  }
+  gst_print ("Switching the video codec to %s\n", codec.encoding_name);
+
+  GstPad *sinkpads[2] = {};
+  const char *pad_names[] = { "video_src", "audio_src" };
+  for (int i = 0; i < 2; i++) {
+    auto pad = gst_element_get_static_pad (old_source, pad_names[i]);
+    sinkpads[i] = gst_pad_get_peer (pad);
+    gst_object_unref (pad);
+  }
+
+  /* Stopped first, so that nothing is pushed into the unlinked pads. The
+   * source is named like the new one, so it leaves the bin (we keep our
+   * reference) before the new one can join it. */
+  gst_element_set_state (old_source, GST_STATE_NULL);
+  unlink_media_source (old_source);
+  gst_bin_remove (GST_BIN (pipe1), old_source);
+
+  gst_bin_add (GST_BIN (pipe1), source);
+  bool ok = link_media_source (source, sinkpads)
+      && gst_element_sync_state_with_parent (source);
+
+  if (!ok) {
+    gst_printerr ("Failed to start the %s media source, keeping the previous one\n", codec.encoding_name);
+    gst_element_set_state (source, GST_STATE_NULL);
+    unlink_media_source (source);
+    gst_bin_remove (GST_BIN (pipe1), source);
+
+    video_codec = old_codec;
+    video_encoder_spec = old_encoder_spec;
+    temporal_layers = old_layers;
+    temporal_layers_sent = old_layers;
+
+    gst_bin_add (GST_BIN (pipe1), old_source);
+    const bool restored = link_media_source (old_source, sinkpads)
+        && gst_element_sync_state_with_parent (old_source);
+    gst_object_unref (old_source);
+    for (auto sinkpad : sinkpads)
+      if (sinkpad)
+        gst_object_unref (sinkpad);
+
+    if (!restored) {
+      cleanup_and_quit_loop ("ERROR: failed to restore the media source", PEER_CALL_ERROR);
+      return CodecSwitch::Failed;
+    }
+    return CodecSwitch::Kept;
+  }
+
+  gst_object_unref (old_source);
+  media_source_description = media_source_key (codec, payload_type);
+
+  if (video_encoder)
+    gst_object_unref (video_encoder);
+  video_encoder = gst_bin_get_by_name (GST_BIN (source), "videoenc");
+  video_target_bitrate = 0;
+  encode_latency.reset ();
+
+  if (offer) {
+    deferred_offer = gst_webrtc_session_description_copy (offer);
+    auto pad = gst_element_get_static_pad (source, "video_src");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, switched_source_flowing_probe, this, nullptr);
+    gst_object_unref (pad);
+
+    /* A source that never starts leaves the call without video, not without
+     * an answer */
+    deferred_offer_id = add_engine_source (DEFERRED_OFFER_TIMEOUT_MS, apply_deferred_offer);
+  }
+  for (auto sinkpad : sinkpads)
+    if (sinkpad)
+      gst_object_unref (sinkpad);
+  return CodecSwitch::Switched;
+}
+
+void set_remote_offer (GstWebRTCSessionDescription * offer)
 {
-  GstPromise *promise;
+  auto promise = gst_promise_new_with_change_func (on_offer_set, this, nullptr);
+  g_signal_emit_by_name (webrtc1, "set-remote-description", offer, promise);
+}
 
+/* The answerer picks the codec: the first of our preferences the offer
+ * carries. Narrowing the codec-preferences to it makes webrtcbin answer with
+ * the codec we are going to send, at the offer's payload type. */
+void on_offer_received (GstSDPMessage * sdp)
+{
   auto offer = gst_webrtc_session_description_new (GST_WEBRTC_SDP_TYPE_OFFER, sdp);
   g_assert_nonnull (offer);
 
-  /* Set remote description on our pipeline */
-  {
-    promise = gst_promise_new_with_change_func (on_offer_set, this, nullptr);
-    g_signal_emit_by_name (webrtc1, "set-remote-description", offer, promise);
+  int payload_type = 0;
+  auto codec = choose_offered_video_codec (sdp, preferred_video_codecs (g_settings.video_codecs),
+      is_available, payload_type);
+  if (!codec) {
+    gst_printerr ("The offer has no video codec we can send\n");
+  } else {
+    const auto previous_preferences = video_codec_preferences;
+    set_video_codec_preferences (sent_video_caps (*codec, payload_type));
+
+    if (media_source_description != media_source_key (*codec, payload_type)) {
+      switch (switch_video_codec (*codec, payload_type, offer)) {
+      case CodecSwitch::Switched:
+      case CodecSwitch::Failed:
+        gst_webrtc_session_description_free (offer);
+        return;
+      case CodecSwitch::Kept:
+        set_video_codec_preferences (previous_preferences);
+        break;
+      }
+    }
   }
+
+  /* Set remote description on our pipeline */
+  set_remote_offer (offer);
   gst_webrtc_session_description_free (offer);
 }
 
+/* The offerer sends its first preference until the answer names the codec;
+ * a peer preferring another one answers with that. False if the call has
+ * been ended. */
+bool on_answer_received (const GstSDPMessage * sdp)
+{
+  int payload_type = 0;
+  auto codec = choose_offered_video_codec (sdp, {}, is_available, payload_type);
+  if (!codec) {
+    gst_printerr ("The answer has no video codec we can send\n");
+    return true;
+  }
+  if (media_source_description == media_source_key (*codec, payload_type))
+    return true;
+
+  switch (switch_video_codec (*codec, payload_type, nullptr)) {
+  case CodecSwitch::Switched:
+    return true;
+  case CodecSwitch::Kept:
+    gst_printerr ("The peer answered with %s, which we could not switch to\n", codec->encoding_name);
+    return true;
+  case CodecSwitch::Failed:
+    break;
+  }
+  return false;
+}
+
 /* One mega message handler for our asynchronous calling mechanism */
 void on_server_message(const gchar *text) {
   if (g_strcmp0 (text, "OFFER_REQUEST") == 0) {
@@ -1341,9 +2697,10 @@ void on_server_message(const gchar *text) {
     }
 
     /* If peer connection wasn't made yet and we are expecting peer will
-     * connect to us, launch pipeline at this moment */
-    if (!webrtc1 && !signaling_connection->we_create_offer()) {
-      if (!start_pipeline (FALSE)) {
+     * connect to us, launch pipeline at this moment (unless prebuilt) */
+    if (!signaling_connection->we_create_offer()
+        && (!webrtc1 || (prebuilt && app_state < PEER_CALL_NEGOTIATING))) {
+      if (!webrtc1 && !start_pipeline (FALSE)) {
         cleanup_and_quit_loop ("ERROR: failed to start pipeline",
             PEER_CALL_ERROR);
       }
@@ -1371,7 +2728,17 @@ void on_server_message(const gchar *text) {
        *
        * See tests/examples/webrtcbidirectional.c in gst-plugins-bad for another
        * example how to handle offers from peers and reply with answers using webrtcbin. */
-      text = json_object_get_string_member (child, "sdp");
+      std::string expanded;
+      if (json_object_has_member (child, "zsdp")) {
+        if (!compact_sdp_decode (json_object_get_string_member (child, "zsdp"), expanded)) {
+          cleanup_and_quit_loop ("ERROR: received malformed compact SDP",
+              PEER_CALL_ERROR);
+          return;
+        }
+        text = expanded.c_str ();
+      } else {
+        text = json_object_get_string_member (child, "sdp");
+      }
       GstSDPMessage *sdp;
       auto ret = gst_sdp_message_new (&sdp);
       g_assert_cmphex (ret, ==, GST_SDP_OK);
@@ -1392,7 +2759,14 @@ void on_server_message(const gchar *text) {
           gst_promise_interrupt (promise);
           gst_promise_unref (promise);
         }
+        const bool sending = on_answer_received (sdp);
+        gst_webrtc_session_description_free (answer);
+        if (!sending) {
+          g_object_unref (parser);
+          return;
+        }
         app_state = PEER_CALL_STARTED;
+        mark_call_setup ("offer/answer");
       } else {
         gst_print ("Received offer:\n%s\n", text);
         on_offer_received (sdp);
@@ -1406,6 +2780,15 @@ void on_server_message(const gchar *text) {
             auto candidate = json_object_get_string_member(child, "candidate");
             auto sdpmlineindex = (guint)json_object_get_int_member(child, "sdpMLineIndex");
 
+            {
+                std::lock_guard<std::mutex> lock(ice_mtx);
+                if (ice_filter && !ice_filter->accept_remote(candidate)) {
+                    ++filtered_candidates;
+                    continue;
+                }
+                count_candidate(candidate, &CandidateCount::remote);
+            }
+
             /* Add ice candidate sent by remote peer */
             g_signal_emit_by_name(webrtc1, "add-ice-candidate", sdpmlineindex,
                 candidate);
@@ -1419,26 +2802,67 @@ void on_server_message(const gchar *text) {
 }
 
 
-static gpointer glibMainLoopThreadFunc(gpointer data)
+static gpointer engine_thread_func(gpointer data)
 {
     auto self = static_cast<SendRecv *>(data);
 
-    self->signaling_connection = get_signaling_connection(g_settings.session_id);
+    g_main_context_push_thread_default(self->engine_context);
+    g_main_loop_run(self->engine_loop);
+    g_main_context_pop_thread_default(self->engine_context);
+
+    return nullptr;
+}
+
+/* Engine task: sets up signaling (and, on the fast path, the pipeline) for a
+ * new call. */
+static gboolean begin_call(gpointer data)
+{
+    auto self = static_cast<SendRecv *>(data);
+
+    self->signaling_connection = get_signaling_connection(g_settings.session_id,
+        g_settings.signaling_transport, g_settings.signaling_relay_url);
+
+    if (!self->signaling_connection) {
+        self->cleanup_and_quit_loop("ERROR: signaling is not configured", PEER_CALL_ERROR);
+        return G_SOURCE_REMOVE;
+    }
+
+    self->call_setup_start = std::chrono::steady_clock::now();
+    prepare_ice_servers(STUN_SERVER, turn_server_uri());
+    if (!self->signaling_connection->connect_to_server_async()) {
+        self->cleanup_and_quit_loop("ERROR: failed to start signaling", PEER_CALL_ERROR);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (g_settings.fast_call_setup) {
+        self->prebuilt = true;
+        if (!self->start_pipeline(FALSE))
+            self->cleanup_and_quit_loop("ERROR: failed to start pipeline", PEER_CALL_ERROR);
+    }
 
-    self->loop = g_main_loop_new(nullptr, false);
+    return G_SOURCE_REMOVE;
+}
+
+/* Engine task: releases everything belonging to the current call and leaves
+ * the engine idle, ready for the next one. */
+static gboolean end_call(gpointer data)
+{
+    auto self = static_cast<SendRecv *>(data);
 
-    self->signaling_connection->connect_to_server_async();
+    self->remove_engine_source(self->webrtcbin_get_stats_id);
 
-    g_main_loop_run(self->loop);
-    if (self->loop)
-        g_clear_pointer(&self->loop, g_main_loop_unref);
-    self->loop = nullptr;
+    self->cancel_ice_flush();
 
-    if (self->webrtcbin_get_stats_id)
-        g_source_remove(self->webrtcbin_get_stats_id);
-    self->webrtcbin_get_stats_id = 0;
+    if (self->signaling_connection)
+        self->signaling_connection->close();
 
     if (self->pipe1) {
+      GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (self->pipe1));
+      gst_bus_remove_watch (bus);
+      gst_object_unref (bus);
+
+      self->park_media_source ();
+
       gst_element_set_state (GST_ELEMENT (self->pipe1), GST_STATE_NULL);
       gst_print ("Pipeline stopped\n");
       gst_object_unref (self->pipe1);
@@ -1449,32 +2873,142 @@ static gpointer glibMainLoopThreadFunc(gpointer data)
     self->signaling_connection.reset();
 
     self->ice_candidates.clear();
+    self->ice_filter.reset();
+    {
+        std::lock_guard<std::mutex> lock(self->ice_mtx);
+        self->remove_engine_source(self->ice_restart_id);
+        self->ice_restart_attempts = 0;
+        self->ice_lost_time = {};
+    }
+    self->candidate_counts.clear();
+    self->filtered_candidates = 0;
+    self->local_description_sent = false;
+    self->first_candidate_sent = false;
+
+    self->dtls_pem.clear();
+    self->ice_connected_time = {};
+    self->dtls_reported = false;
+
+    if (self->video_encoder)
+        gst_object_unref(self->video_encoder);
+    self->video_encoder = nullptr;
+    self->audio_reserve = 0;
+    self->estimated_bitrate = 0;
+    self->video_target_bitrate = 0;
+    self->reported_bitrate = 0;
+    if (self->layer_dropped_frames)
+        gst_print("Temporal layers: %u frames left out\n", self->layer_dropped_frames.load());
+    self->layer_dropped_frames = 0;
+    self->temporal_layers_sent = self->temporal_layers;
+    {
+        std::lock_guard<std::mutex> lock(self->keyframe_mtx);
+        if (self->keyframes)
+            gst_print("Keyframes sent: %u, %" G_GUINT64_FORMAT " bytes on average; requested %u times, %u deferred\n",
+                self->keyframes, self->keyframe_bytes / self->keyframes,
+                self->keyframe_requests, self->keyframe_requests_deferred);
+        self->last_forced_keyframe = {};
+        self->keyframe_request_deferred = false;
+        self->replayed_request_seqnum = GST_SEQNUM_INVALID;
+        self->keyframes = 0;
+        self->keyframe_bytes = 0;
+        self->keyframe_requests = 0;
+        self->keyframe_requests_deferred = 0;
+    }
+    {
+        const auto encoding = self->encode_latency.summary();
+        if (encoding.frames)
+            gst_print("Encoding: %u frames at %.1f fps, latency %.2f ms average, %.2f ms p95, %.2f ms max\n",
+                encoding.frames, encoding.fps, encoding.average_ms, encoding.p95_ms, encoding.max_ms);
+        self->encode_latency.reset();
+    }
 
-    return nullptr;
+    self->drop_deferred_offer();
+    self->video_codec_preferences.clear();
+
+    self->prebuilt = false;
+    self->negotiation_needed = false;
+    self->is_offerer = false;
+    self->offer_requested = false;
+    self->handshake_done = false;
+    if (self->pending_offer)
+        gst_webrtc_session_description_free(self->pending_offer);
+    self->pending_offer = nullptr;
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean quit_engine(gpointer data)
+{
+    auto self = static_cast<SendRecv *>(data);
+    self->drop_media_source();
+    g_main_loop_quit(self->engine_loop);
+    return G_SOURCE_REMOVE;
 }
 
 
 bool start_sendrecv(unsigned long long winid, ISendRecv* sendrecv, Settings settings)
 {
+    std::lock_guard<std::mutex> lock(engine_mtx);
+
+    if (in_call)
+        return true;
+
+    if (!check_plugins ())
+        return false;
+
+    if (!engine_thread) {
+        engine_context = g_main_context_new();
+        engine_loop = g_main_loop_new(engine_context, false);
+        engine_thread = g_thread_new("media-engine", engine_thread_func, this);
+    }
+
     // store settings globally for free functions to read
     g_settings = std::move(settings);
 
-    if (loop == nullptr) {
-        if (!check_plugins ())
-            return false;
+    xwinid = winid;
 
-        xwinid = winid;
+    p_sendrecv = sendrecv;
 
-        p_sendrecv = sendrecv;
+    app_state = APP_STATE_UNKNOWN;
 
-        app_state = APP_STATE_UNKNOWN;
+    answer_time = std::chrono::steady_clock::now();
 
-        gthread = g_thread_new(nullptr, glibMainLoopThreadFunc, this);
-    }
+    if (!g_settings.dtls_certificate_path.empty())
+        prepare_dtls_certificate(g_settings.dtls_certificate_path);
+
+    in_call = true;
+    post_engine_task(begin_call);
 
     return true;
 }
 
+/* Tears down any call still pending, stops the engine thread and closes the
+ * signaling warm-up connection. */
+void shutdown_sendrecv()
+{
+    {
+        std::lock_guard<std::mutex> lock(engine_mtx);
+        if (engine_thread) {
+            if (in_call) {
+                in_call = false;
+                post_engine_task(end_call);
+            }
+            post_engine_task(quit_engine);
+        }
+    }
+
+    if (engine_thread) {
+        g_thread_join(engine_thread);
+        engine_thread = nullptr;
+
+        g_clear_pointer(&engine_loop, g_main_loop_unref);
+        g_clear_pointer(&engine_context, g_main_context_unref);
+    }
+
+    // Its pool outlives the calls, and has to go before curl is cleaned up at exit.
+    stop_signaling_warmup();
+}
+
 }; // class SendRecv
 
 
@@ -1490,6 +3024,11 @@ bool set_connected()
     return sendrecv.set_connected();
 }
 
+void on_peer_discovered()
+{
+    sendrecv.on_peer_discovered();
+}
+
 void on_server_message(const gchar* text)
 {
     sendrecv.on_server_message(text);
@@ -1505,3 +3044,8 @@ bool start_sendrecv(unsigned long long winid, ISendRecv* isendrecv, Settings set
 {
     return sendrecv.start_sendrecv(winid, isendrecv, std::move(settings));
 }
+
+void shutdown_sendrecv()
+{
+    sendrecv.shutdown_sendrecv();
+}
@@ -5,6 +5,9 @@
 
 #include <glib.h> // for gchar, gboolean
 
+#include "signaling_connection.h" // for SignalingTransport
+#include "ice_policy.h" // for IceCandidatePolicy, IceAddressFamily
+
 // Use a wide string for paths on Windows, UTF-8 std::string elsewhere.
 #ifdef _WIN32
 using PathString = std::wstring;
@@ -22,6 +25,25 @@ struct Settings
     std::string audio_launch_line;     // pipeline fragment for audio source
     int slice_duration_secs = 0;       // >0 => enable splitmuxsink slicing
     std::string session_id;           // session id for signaling (privately shared string)
+    bool trickle_ice = true;           // send ICE candidates while still gathering
+    int ice_flush_interval_ms = 50;    // trickle ICE coalescing window
+    bool compact_sdp = true;           // deflate SDP for peers announcing support
+    bool fast_call_setup = true;       // build the pipeline and offer while handshaking
+    bool warm_standby = true;          // keep capture and encoders in READY between calls
+    PathString dtls_certificate_path;  // cached DTLS certificate; empty to let the dtls plugin make one
+    IceCandidatePolicy ice_candidate_policy = IceCandidatePolicy::All;
+    IceAddressFamily ice_address_family = IceAddressFamily::Any;
+    bool ice_tcp = true;               // gather and accept TCP candidates
+    std::string ice_allowed_networks;  // comma separated CIDR masks; empty allows all
+    std::string ice_denied_networks;   // comma separated CIDR masks kept out of ICE
+    int encoder_threads = 0;           // VP8 encoder threads; 0 = from cores and resolution
+    int encoder_token_partitions = 0;  // 1, 2, 4 or 8; 0 = from cores and resolution
+    int encoder_speed = 0;             // realtime speed 1..16 (cpu-used -N); 0 = from cores and resolution
+    std::string video_codecs = "VP8, VP9, H264, AV1"; // comma separated preference; the first installed one is sent
+    int temporal_layers = 1;           // VP8 temporal layers, 1 (off) to 3
+    SignalingTransport signaling_transport = SignalingTransport::Ntfy;
+    std::string signaling_relay_url;   // ws:// or wss:// relay for SignalingTransport::WebSocket
+    bool headless = false;             // received media goes to fakesink: no window, no sound
 };
 
 // Forward declare ISendRecv to avoid header dependency
@@ -30,9 +52,14 @@ struct ISendRecv;
 // External API used by the rest of the program
 void cleanup_and_quit_loop(const gchar* msg, bool is_error);
 bool set_connected();
+void on_peer_discovered();
 void on_server_message(const gchar* text);
 gboolean start_pipeline(gboolean create_offer);
 
 // Start sendrecv: pass platform settings by value (copied into the worker).
 bool start_sendrecv(unsigned long long winid, ISendRecv* isendrecv, Settings settings);
 
+// Stops the media engine thread and the signaling warm-up; call once at exit,
+// after the last hang-up.
+void shutdown_sendrecv();
+
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "signaling_connection.h"
+
+#include <glib.h>
+
+#include <crossguid/guid.hpp>
+
+#include <QDebug>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Ordered, bounded queue of outgoing signaling messages.
+ *
+ * push() may be called from any thread and never blocks. Messages are handed
+ * to the transport one at a time, in order, from the GMainContext the queue
+ * was created on, and the time from enqueueing to delivery is reported for
+ * every message. A failed delivery is retried a couple of times.
+ */
+class OutboundQueue
+{
+public:
+    // Starts delivering a message; 'done' is to be called on the queue's context.
+    typedef std::function<void(const std::string& message, std::function<void(bool ok)> done)> DeliverFunc;
+
+    enum { MAX_PENDING = 64, MAX_ATTEMPTS = 3, RETRY_DELAY_MS = 500 };
+
+    OutboundQueue(GMainContext* context, DeliverFunc deliver)
+        : context(context ? g_main_context_ref(context) : g_main_context_ref_thread_default())
+        , deliver(std::move(deliver))
+    {}
+    ~OutboundQueue()
+    {
+        stop();
+        g_main_context_unref(context);
+    }
+
+    OutboundQueue(const OutboundQueue&) = delete;
+    OutboundQueue& operator =(const OutboundQueue&) = delete;
+
+    bool push(std::string message)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping)
+            return false;
+        if (pending.size() >= MAX_PENDING) {
+            qCritical() << "Outbound signaling queue is full, dropping message";
+            return false;
+        }
+        pending.push_back({ std::move(message), std::chrono::steady_clock::now() });
+        schedule(0);
+        return true;
+    }
+
+    // Pending messages are dropped.
+    void stop()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+        pending.clear();
+        if (kick) {
+            g_source_destroy(kick);
+            g_source_unref(kick);
+            kick = nullptr;
+        }
+    }
+
+private:
+    struct Item
+    {
+        std::string message;
+        std::chrono::steady_clock::time_point enqueued;
+        int attempts = 0;
+    };
+
+    // Called with mtx held.
+    void schedule(guint delay_ms)
+    {
+        if (kick || in_flight || stopping || pending.empty())
+            return;
+        kick = delay_ms ? g_timeout_source_new(delay_ms) : g_idle_source_new();
+        g_source_set_callback(kick, on_kick, this, nullptr);
+        g_source_attach(kick, context);
+    }
+
+    static gboolean on_kick(gpointer data)
+    {
+        auto self = static_cast<OutboundQueue*>(data);
+
+        std::string message;
+        {
+            std::lock_guard<std::mutex> lock(self->mtx);
+            if (self->kick) {
+                g_source_unref(self->kick);
+                self->kick = nullptr;
+            }
+            if (self->stopping || self->pending.empty())
+                return G_SOURCE_REMOVE;
+            self->in_flight = true;
+            message = self->pending.front().message;
+        }
+
+        self->deliver(message, [self](bool ok) { self->on_delivered(ok); });
+
+        return G_SOURCE_REMOVE;
+    }
+
+    void on_delivered(bool ok)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        in_flight = false;
+        if (stopping || pending.empty())
+            return;
+
+        auto& item = pending.front();
+        const auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - item.enqueued).count();
+
+        if (ok) {
+            qDebug() << "Signaling message delivered in" << latency << "ms, still queued:" << pending.size() - 1;
+        }
+        else if (++item.attempts < MAX_ATTEMPTS) {
+            qWarning() << "Signaling message delivery failed, retrying";
+            schedule(RETRY_DELAY_MS * item.attempts);
+            return;
+        }
+        else {
+            qCritical() << "Signaling message delivery failed after" << latency << "ms";
+        }
+
+        pending.pop_front();
+        schedule(0);
+    }
+
+    GMainContext* context;
+    DeliverFunc deliver;
+
+    std::mutex mtx;
+    std::deque<Item> pending;
+    GSource* kick = nullptr;
+    bool in_flight = false;
+    bool stopping = false;
+};
+
+
+/*
+ * Common part of the signaling transports: GUID-prefixed message framing and
+ * the authenticated SYN/ACK handshake that precedes SDP/ICE exchange.
+ *
+ * The SYN is preceded by "CAPS <token>...", listing the optional features we
+ * understand; peers not knowing the message just ignore it.
+ *
+ * Messages longer than the transport's max_message_size() go out as
+ * "FRAG <id> <index>/<count>\n<chunk>" fragments and are put back together
+ * on the receiving side before anything else looks at them.
+ *
+ * A transport calls on_transport_open() once it can exchange messages, hands
+ * every framed message it receives to on_transport_message(), and puts the
+ * framed messages produced by send_text() on the wire in transmit().
+ */
+class HandshakeSignalingConnection : public ISignalingConnection
+{
+public:
+    explicit HandshakeSignalingConnection(std::string sid) : session_id(std::move(sid)) {}
+    ~HandshakeSignalingConnection() override;
+
+    bool peer_has_capability(const char *name) override;
+
+    struct FragmentStats
+    {
+        unsigned sent = 0;      // fragments
+        unsigned received = 0;  // fragments
+        unsigned expired = 0;   // incomplete messages dropped
+    };
+    FragmentStats fragment_stats() const;
+
+protected:
+    bool we_create_offer() override;
+    void send_text(const char *text) override;
+
+    // Puts one framed message on the wire; may be called from any thread.
+    virtual void transmit(std::string message) = 0;
+
+    // Largest framed message the transport delivers intact; 0 if unlimited.
+    virtual size_t max_message_size() const { return 0; }
+
+    void on_transport_open();
+    void on_transport_message(const char* text);
+
+    xg::Guid their_giud;
+
+    std::string peer_capabilities; // space separated, as received in CAPS
+
+    std::atomic_bool requestInterrupted = false;
+
+    std::string session_id;
+
+private:
+    enum {
+        MAX_PARTIAL_MESSAGES = 8,
+        MAX_REASSEMBLY_BYTES = 256 * 1024,
+        REASSEMBLY_TIMEOUT_MS = 10000,
+        EXPIRY_CHECK_INTERVAL_MS = 1000,
+    };
+
+    struct PartialMessage
+    {
+        std::vector<std::string> chunks;
+        unsigned missing = 0;
+        size_t bytes = 0;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    void on_peer_message(const char* message);
+    void on_fragment(const char* fragment);
+    void expire_partial_messages();
+    static gboolean on_expiry_timer(gpointer data);
+
+    std::atomic_uint next_message_id{ 0 };
+
+    // Touched on the receiving thread only.
+    std::map<unsigned, PartialMessage> partial_messages;
+    size_t reassembly_bytes = 0;
+
+    // On the receiving thread's context while messages are incomplete, so
+    // that they expire even if no further fragment comes.
+    GSource* expiry_timer = nullptr;
+
+    std::atomic_uint fragments_sent{ 0 };
+    unsigned fragments_received = 0;
+    unsigned messages_expired = 0;
+};
+
+// Topic name derived from the session id; the id itself never leaves the host.
+std::string hashed_session_topic(const std::string& session_id);
+
+std::unique_ptr<ISignalingConnection> make_loopback_signaling_connection(std::string sid);
+std::unique_ptr<ISignalingConnection> make_websocket_signaling_connection(std::string sid,
+    const std::string& relay_url);
@@ -1,22 +1,30 @@
 ﻿#include "signaling_connection.h"
+#include "signaling_base.h"
 
 #include "sendrecv.h"
 
 #include "http.h"
+#include "ntfy_subscriptions.h"
+#include "base64url.h"
+#include "compact_sdp.h"
 
 #include "globals.h"
 
 #include "makeguard.h"
 
-#include <json-glib/json-glib.h>
-
 #include <crossguid/guid.hpp>
 
 #include <QDebug>
 
-#include <thread>
-#include <future>
+#include <algorithm>
+#include <atomic>
 #include <mutex>
+#include <deque>
+#include <chrono>
+#include <map>
+#include <set>
+#include <ctime>
+#include <thread>
 
 #ifdef _MSC_VER
 #  undef restrict
@@ -58,303 +66,531 @@ static std::string sha256(const std::string& data) {
     return std::string(reinterpret_cast<char*>(hash), hash_len);
 }
 
-// URL-safe Base64 (RFC 4648 #5) without padding.
-// Input `bin` contains raw bytes (may have '\0' bytes).
-static std::string base64url_encode(const std::string& bin) {
-    static const char alphabet[] =
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz"
-        "0123456789-_"; // base64url alphabet: '+' -> '-', '/' -> '_'
-    size_t len = bin.size();
-    std::string out;
-    out.reserve(((len + 2) / 3) * 4);
-
-    size_t i = 0;
-    while (i + 2 < len) {
-        unsigned int b0 = static_cast<unsigned char>(bin[i]);
-        unsigned int b1 = static_cast<unsigned char>(bin[i + 1]);
-        unsigned int b2 = static_cast<unsigned char>(bin[i + 2]);
-        out.push_back(alphabet[(b0 >> 2) & 0x3F]);
-        out.push_back(alphabet[((b0 & 0x3) << 4) | ((b1 >> 4) & 0xF)]);
-        out.push_back(alphabet[((b1 & 0xF) << 2) | ((b2 >> 6) & 0x3)]);
-        out.push_back(alphabet[b2 & 0x3F]);
-        i += 3;
-    }
-
-    size_t rem = len - i;
-    if (rem == 1) {
-        unsigned int b0 = static_cast<unsigned char>(bin[i]);
-        out.push_back(alphabet[(b0 >> 2) & 0x3F]);
-        out.push_back(alphabet[((b0 & 0x3) << 4) & 0x3F]);
-        // no padding
-    }
-    else if (rem == 2) {
-        unsigned int b0 = static_cast<unsigned char>(bin[i]);
-        unsigned int b1 = static_cast<unsigned char>(bin[i + 1]);
-        out.push_back(alphabet[(b0 >> 2) & 0x3F]);
-        out.push_back(alphabet[((b0 & 0x3) << 4) | ((b1 >> 4) & 0xF)]);
-        out.push_back(alphabet[((b1 & 0xF) << 2) & 0x3F]);
-        // no padding
-    }
-
-    return out;
-}
+const xg::Guid this_guid = xg::newGuid();
 
+const char ntfy_url[] = "https://ntfy.sh/";
 
+// Use a safe topic prefix; we'll append hashed session id.
+const char topic_prefix[] = "mediaThorSR_";
 
-const xg::Guid this_guid = xg::newGuid();
+// Cheap request to the same host, used to open the connection in advance.
+const char warmup_url[] = "https://ntfy.sh/v1/health";
 
-// Use safe URL prefix constants; we'll append hashed session id.
-const char message_url_prefix[] = "https://ntfy.sh/mediaThorSR_";
 
+namespace {
 
-class NtfySignalingConnection : public ISignalingConnection
+/*
+ * Resolves the ntfy host and opens a keep-alive TLS connection in the pool
+ * the next NtfySignalingConnection starts with, so that the first call does
+ * not pay for DNS, TCP and TLS. The pool is handed back when the connection
+ * goes away and serves the following call in turn.
+ *
+ * curl is cleaned up at exit before this object is destroyed, so stop() has
+ * to come first; see stop_signaling_warmup().
+ */
+class SignalingWarmup
 {
 public:
-    NtfySignalingConnection(std::string sid) : session_id(std::move(sid)) {}
-    ~NtfySignalingConnection() override
+    ~SignalingWarmup()
     {
-        doClose();
+        stop();
     }
-protected:
-    bool we_create_offer() override
+
+    void start()
     {
-        return this_guid.bytes() < their_giud.bytes();
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping || pool || thread.joinable())
+            return;
+
+        pool = std::make_shared<HttpPool>();
+        thread = std::thread([this, pool = pool] {
+            const auto started = std::chrono::steady_clock::now();
+            const bool ok = connect(*pool);
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started).count();
+            qDebug() << "Signaling warm-up" << (ok ? "connected" : "failed") << "in" << elapsed << "ms (cold)";
+        });
     }
 
-    void send_text(const char *text) override
+    // Aborts the warm-up request and drops the pool; start() does nothing after it.
+    void stop()
     {
-        const auto message = this_guid.str() + '\n' + text;
+        stopping = true;
+        if (thread.joinable())
+            thread.join();
 
+        std::lock_guard<std::mutex> lock(mtx);
+        pool.reset();
+    }
 
-        std::string hashed = base64url_encode(sha256(session_id));
-        std::string url = message_url_prefix + hashed;
+    // The pool, if any, and whether it holds a warm connection.
+    std::shared_ptr<HttpPool> take(bool& is_warm)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        is_warm = pool && pool->has_idle_connection();
+        return std::move(pool);
+    }
 
-        http(HTTP_POST, url.c_str(), nullptr, message.c_str(), message.length());
+    void give_back(std::shared_ptr<HttpPool> used)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!pool && !stopping)
+            pool = std::move(used);
     }
 
-    static const char* verify_sse_response(CURL* curl) {
-#define EXPECTED_CONTENT_TYPE "text/event-stream"
+private:
+    /*
+     * One attempt, on a pooled handle, so that the connection stays in the
+     * pool's share. Not through http(): its retries sleep between attempts,
+     * and stop() would wait for them when offline. The progress callback,
+     * which curl also calls while resolving and connecting, aborts it.
+     */
+    bool connect(HttpPool& pool)
+    {
+        CURL* curl = pool.acquire();
+        if (!curl)
+            return false;
 
-        static const char expected_content_type[] = EXPECTED_CONTENT_TYPE;
+        curl_easy_setopt(curl, CURLOPT_URL, warmup_url);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
+            +[](char*, size_t size, size_t nmemb, void*) { return size * nmemb; });
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION,
+            +[](void* data, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+                return static_cast<SignalingWarmup*>(data)->stopping ? 1 : 0;
+            });
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+
+        const bool ok = curl_easy_perform(curl) == CURLE_OK;
+        pool.release(curl);
+        return ok;
+    }
 
-        const char* content_type;
-        curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
-        if (!content_type) content_type = "";
+    std::mutex mtx;
+    std::shared_ptr<HttpPool> pool;
+    std::thread thread;
+    std::atomic_bool stopping = false;
+};
 
-        if (!strncmp(content_type, expected_content_type, strlen(expected_content_type)))
-            return nullptr;
+SignalingWarmup signaling_warmup;
+
+} // namespace
+
+void warm_up_signaling()
+{
+    signaling_warmup.start();
+}
+
+void stop_signaling_warmup()
+{
+    signaling_warmup.stop();
+}
+
+
+std::string hashed_session_topic(const std::string& session_id)
+{
+    return base64url_encode(sha256(session_id));
+}
+
+
+bool HandshakeSignalingConnection::we_create_offer()
+{
+    return this_guid.bytes() < their_giud.bytes();
+}
 
-        return "Invalid content_type, should be '" EXPECTED_CONTENT_TYPE "'.";
+HandshakeSignalingConnection::~HandshakeSignalingConnection()
+{
+    if (expiry_timer) {
+        g_source_destroy(expiry_timer);
+        g_source_unref(expiry_timer);
     }
 
-    bool connect_to_server_async() override
+    const auto stats = fragment_stats();
+    if (stats.sent || stats.received)
+        qDebug() << "Signaling fragments sent:" << stats.sent << "received:" << stats.received
+            << "expired messages:" << stats.expired;
+}
+
+HandshakeSignalingConnection::FragmentStats HandshakeSignalingConnection::fragment_stats() const
+{
+    FragmentStats stats;
+    stats.sent = fragments_sent;
+    stats.received = fragments_received;
+    stats.expired = messages_expired;
+    return stats;
+}
+
+void HandshakeSignalingConnection::send_text(const char *text)
+{
+    std::string prefix = this_guid.str() + '\n';
+    const size_t text_len = strlen(text);
+
+    const size_t limit = max_message_size();
+    if (limit == 0 || prefix.size() + text_len <= limit) {
+        transmit(prefix + text);
+        return;
+    }
+
+    // Room for "FRAG <id> <index>/<count>\n" with up to 10 digit numbers.
+    const size_t overhead = prefix.size() + 5 + 3 * 11 + 1;
+    if (limit <= overhead + 16) {
+        qCritical() << "Signaling message does not fit the transport, dropping it";
+        return;
+    }
+    const size_t chunk_size = limit - overhead;
+
+    // Split at UTF-8 character boundaries: the broker may reject invalid text.
+    std::vector<std::string_view> chunks;
+    for (size_t pos = 0; pos < text_len; ) {
+        size_t len = std::min(chunk_size, text_len - pos);
+        if (pos + len < text_len)
+            while (len > 1 && (static_cast<unsigned char>(text[pos + len]) & 0xC0) == 0x80)
+                --len;
+        chunks.emplace_back(text + pos, len);
+        pos += len;
+    }
+
+    const unsigned id = next_message_id++;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        std::string fragment = prefix + "FRAG " + std::to_string(id) + ' '
+            + std::to_string(i) + '/' + std::to_string(chunks.size()) + '\n';
+        fragment.append(chunks[i].data(), chunks[i].size());
+        transmit(std::move(fragment));
+        ++fragments_sent;
+    }
+}
+
+bool HandshakeSignalingConnection::peer_has_capability(const char *name)
+{
+    const std::string_view capabilities(peer_capabilities);
+    const size_t len = strlen(name);
+    for (size_t pos = 0; pos < capabilities.size(); ) {
+        auto end = capabilities.find(' ', pos);
+        if (end == std::string_view::npos)
+            end = capabilities.size();
+        if (end - pos == len && capabilities.compare(pos, len, name) == 0)
+            return true;
+        pos = end + 1;
+    }
+    return false;
+}
+
+void HandshakeSignalingConnection::on_transport_open()
+{
+    // Sent first so that it is known by the time the peer starts negotiating.
+    send_text("CAPS " COMPACT_SDP_CAPABILITY);
+
+    // =========================
+    // SEND SIDE (SYN)
+    // =========================
+
+    // timestamp
+    time_t now = time(nullptr);
+    std::string ts = std::to_string(now);
+
+    // macA = HMAC(session_id, this_guid + timestamp + "A")
+    std::string macA = base64url_encode(
+        hmac_sha256(session_id, this_guid.str() + ts + "A")
+    );
+
+    // SYN <timestamp> <macA>
+    std::string syn_msg = "SYN " + ts + " " + macA;
+    send_text(syn_msg.c_str());
+}
+
+void HandshakeSignalingConnection::on_transport_message(const char* text)
+{
+    if (auto pos = strchr(text, '\n'); pos != nullptr && pos != text)
     {
-        std::promise<bool> startedPromise;
-
-        auto startedResult = startedPromise.get_future();
-
-        auto threadLam = [this](
-            std::promise<bool> startedPromise
-            ) {
-                const char* headers[] = {
-                    "Accept: text/event-stream",
-                    nullptr
-                };
-
-                auto on_data = [this, &startedPromise](char *ptr, size_t size, size_t nmemb)->size_t {
-                    if (requestInterrupted)
-                        return size * nmemb;
-                    try {
-                        const auto ptrEnd = ptr + size * nmemb;
-
-                        const char watch[] = "data:";
-
-                        auto pData = std::search(ptr, ptrEnd, std::begin(watch), std::prev(std::end(watch)));
-                        if (pData != ptrEnd) do {
-                            pData += sizeof(watch) / sizeof(watch[0]) - 1;
-
-                            auto parser = MakeGuard(json_parser_new(), g_object_unref);
-                            if (!json_parser_load_from_data(parser.get(), pData, ptrEnd - pData, nullptr)) {
-                                //gst_printerr("Unknown message '%s', ignoring\n", text);
-                                //g_object_unref(parser);
-                                break; //goto out;
-                            }
-
-                            auto root = json_parser_get_root(parser.get());
-                            if (!JSON_NODE_HOLDS_OBJECT(root)) {
-                                //gst_printerr("Unknown json message '%s', ignoring\n", text);
-                                //g_object_unref(parser);
-                                break; //goto out;
-                            }
-
-                            auto child = json_node_get_object(root);
-
-                            if (!json_object_has_member(child, "event")) {
-                                //g_object_unref(parser);
-                                break; //goto out;
-                            }
-
-                            auto sdptype = json_object_get_string_member(child, "event");
-                            if (g_str_equal(sdptype, "open")) {
-                                startedPromise.set_value(true);
-                            }
-                            else if (g_str_equal(sdptype, "message")) {
-                                auto text = json_object_get_string_member(child, "message");
-
-                                if (auto pos = strchr(text, '\n'); pos != nullptr && pos != text)
-                                {
-                                    std::string_view sender_guid(text, pos - text);
-                                    if (this_guid.str() != sender_guid)
-                                    {
-                                        if (!their_giud.isValid())
-                                            their_giud = xg::Guid{ sender_guid };
-                                        else if (their_giud.str() != sender_guid)
-                                            break; //goto out;
-
-                                        const auto message = pos + 1;
-
-                                        // =========================
-                                        // RECEIVE SIDE (SYN / ACK)
-                                        // =========================
-
-                                        const auto is_syn = g_str_has_prefix(message, "SYN");
-                                        const auto is_ack = !is_syn && g_str_has_prefix(message, "ACK");
-
-                                        if (is_syn) {
-
-                                            // Format: SYN <timestamp> <macA>
-                                            const char* p = message + 4; // skip "SYN "
-
-                                            // Parse timestamp
-                                            char* endptr = nullptr;
-                                            long ts = strtol(p, &endptr, 10);
-                                            if (endptr == p || ts <= 0) {
-                                                qCritical() << "Invalid timestamp in SYN";
-                                                requestInterrupted = true;
-                                                return size * nmemb;
-                                            }
-
-                                            // Skip spaces
-                                            while (*endptr == ' ') endptr++;
-
-                                            const char* macA = endptr;
-
-                                            // Anti‑replay window
-                                            time_t now = time(nullptr);
-                                            constexpr long ALLOWED_DRIFT = 10; // seconds
-
-                                            if (labs(now - ts) > ALLOWED_DRIFT) {
-                                                qCritical() << "Timestamp drift too large, dropping connection";
-                                                requestInterrupted = true;
-                                                return size * nmemb;
-                                            }
-
-                                            // expected macA = HMAC(session_id, their_guid + timestamp + "A")
-                                            std::string expectedA = base64url_encode(
-                                                hmac_sha256(session_id, their_giud.str() + std::to_string(ts) + "A")
-                                            );
-
-                                            if (expectedA != macA) {
-                                                qCritical() << "MAC A mismatch, dropping connection";
-                                                requestInterrupted = true;
-                                                return size * nmemb;
-                                            }
-
-                                            // Build ACK <macB>
-                                            std::string min_id = (std::min)(this_guid.str(), their_giud.str());
-                                            std::string max_id = (std::max)(this_guid.str(), their_giud.str());
-
-                                            std::string macB = base64url_encode(
-                                                hmac_sha256(session_id, min_id + max_id + "B")
-                                            );
-
-                                            std::string ack_msg = "ACK " + macB;
-                                            send_text(ack_msg.c_str());
-                                        }
-
-                                        else if (is_ack) {
-
-                                            // Format: ACK <macB>
-                                            const char* macB = message + 4;
-
-                                            std::string min_id = (std::min)(this_guid.str(), their_giud.str());
-                                            std::string max_id = (std::max)(this_guid.str(), their_giud.str());
-
-                                            std::string expectedB = base64url_encode(
-                                                hmac_sha256(session_id, min_id + max_id + "B")
-                                            );
-
-                                            if (expectedB != macB) {
-                                                qCritical() << "MAC B mismatch, dropping connection";
-                                                requestInterrupted = true;
-                                                return size * nmemb;
-                                            }
-                                        }
-
-                                        if (is_syn || is_ack) {
-                                            if (set_connected()) {
-                                                /* Start negotiation (exchange SDP and ICE candidates) */
-                                                if (we_create_offer() && !start_pipeline(TRUE))
-                                                    cleanup_and_quit_loop("ERROR: failed to start pipeline", true);
-                                            }
-                                        }
-                                        else
-                                            on_server_message(message);
-                                    }
-                                }
-                            }
-                        } while (false);
-                    }
-                    catch (const std::exception& ex) {
-                        qCritical() << "Exception " << typeid(ex).name() << ": " << ex.what();
-                        requestInterrupted = true;
-                        try {
-                            startedPromise.set_value(false);
-                        } catch (...) {
-                        }
-                    }
-                    return size * nmemb;
-                };
-
-                auto progress_callback = [this](curl_off_t dltotal,
-                    curl_off_t dlnow,
-                    curl_off_t ultotal,
-                    curl_off_t ulnow)->size_t {
-                        return requestInterrupted;
-                };
-
-
-                // Build recv URL with hashed session id
-                std::string hashed = base64url_encode(sha256(session_id));
-                std::string url = message_url_prefix + hashed + "/sse";
-
-                http(HTTP_GET, url.c_str(), headers, nullptr, 0, on_data, verify_sse_response, progress_callback);
-        };
-
-        // https://stackoverflow.com/a/23454840/10472202
-        signaling_runner = std::thread(threadLam, std::move(startedPromise));
-
-        if (!startedResult.get())
-            return false;
+        std::string_view sender_guid(text, pos - text);
+        if (this_guid.str() != sender_guid)
+        {
+            if (!their_giud.isValid()) {
+                their_giud = xg::Guid{ sender_guid };
+                on_peer_discovered();
+            }
+            else if (their_giud.str() != sender_guid)
+                return;
+
+            const auto message = pos + 1;
+
+            if (g_str_has_prefix(message, "FRAG "))
+                on_fragment(message + 5);
+            else
+                on_peer_message(message);
+        }
+    }
+}
 
-        // =========================
-        // SEND SIDE (SYN)
-        // =========================
+void HandshakeSignalingConnection::on_fragment(const char* fragment)
+{
+    // Format: FRAG <id> <index>/<count>\n<chunk>
+    unsigned id = 0, index = 0, count = 0;
+    int header_len = 0;
+    if (sscanf(fragment, "%u %u/%u%n", &id, &index, &count, &header_len) != 3
+            || fragment[header_len] != '\n' || count == 0 || index >= count
+            || count > MAX_REASSEMBLY_BYTES / 1024) {
+        qWarning() << "Malformed signaling fragment, ignoring";
+        return;
+    }
+    const char* chunk = fragment + header_len + 1;
+    const size_t chunk_len = strlen(chunk);
+
+    ++fragments_received;
+    expire_partial_messages();
+
+    auto it = partial_messages.find(id);
+    if (it == partial_messages.end()) {
+        if (partial_messages.size() >= MAX_PARTIAL_MESSAGES) {
+            qWarning() << "Too many incomplete signaling messages, dropping fragment";
+            return;
+        }
+        it = partial_messages.emplace(id, PartialMessage{}).first;
+        it->second.chunks.resize(count);
+        it->second.missing = count;
+        it->second.started = std::chrono::steady_clock::now();
+
+        if (!expiry_timer) {
+            expiry_timer = g_timeout_source_new(EXPIRY_CHECK_INTERVAL_MS);
+            g_source_set_callback(expiry_timer, on_expiry_timer, this, nullptr);
+            g_source_attach(expiry_timer, g_main_context_get_thread_default());
+        }
+    }
+
+    auto& partial = it->second;
+    if (partial.chunks.size() != count || !partial.chunks[index].empty() || chunk_len == 0)
+        return; // inconsistent or duplicate
+
+    if (reassembly_bytes + chunk_len > MAX_REASSEMBLY_BYTES) {
+        qWarning() << "Signaling reassembly buffer is full, dropping message";
+        reassembly_bytes -= partial.bytes;
+        partial_messages.erase(it);
+        ++messages_expired;
+        return;
+    }
+
+    partial.chunks[index].assign(chunk, chunk_len);
+    partial.bytes += chunk_len;
+    reassembly_bytes += chunk_len;
+
+    if (--partial.missing != 0)
+        return;
+
+    std::string message;
+    message.reserve(partial.bytes);
+    for (const auto& c : partial.chunks)
+        message += c;
+
+    reassembly_bytes -= partial.bytes;
+    partial_messages.erase(it);
+
+    on_peer_message(message.c_str());
+}
+
+void HandshakeSignalingConnection::expire_partial_messages()
+{
+    const auto deadline = std::chrono::steady_clock::now()
+        - std::chrono::milliseconds(REASSEMBLY_TIMEOUT_MS);
+    for (auto it = partial_messages.begin(); it != partial_messages.end(); ) {
+        if (it->second.started < deadline) {
+            qWarning() << "Signaling message" << it->first << "expired with"
+                << it->second.missing << "fragments missing";
+            reassembly_bytes -= it->second.bytes;
+            it = partial_messages.erase(it);
+            ++messages_expired;
+        }
+        else
+            ++it;
+    }
+}
+
+gboolean HandshakeSignalingConnection::on_expiry_timer(gpointer data)
+{
+    auto self = static_cast<HandshakeSignalingConnection*>(data);
 
-        // timestamp
+    self->expire_partial_messages();
+    if (!self->partial_messages.empty())
+        return G_SOURCE_CONTINUE;
+
+    g_source_unref(self->expiry_timer);
+    self->expiry_timer = nullptr;
+    return G_SOURCE_REMOVE;
+}
+
+void HandshakeSignalingConnection::on_peer_message(const char* message)
+{
+    if (g_str_has_prefix(message, "CAPS ")) {
+        peer_capabilities = message + 5;
+        return;
+    }
+
+    // =========================
+    // RECEIVE SIDE (SYN / ACK)
+    // =========================
+
+    const auto is_syn = g_str_has_prefix(message, "SYN");
+    const auto is_ack = !is_syn && g_str_has_prefix(message, "ACK");
+
+    if (is_syn) {
+
+        // Format: SYN <timestamp> <macA>
+        const char* p = message + 4; // skip "SYN "
+
+        // Parse timestamp
+        char* endptr = nullptr;
+        long ts = strtol(p, &endptr, 10);
+        if (endptr == p || ts <= 0) {
+            qCritical() << "Invalid timestamp in SYN";
+            requestInterrupted = true;
+            return;
+        }
+
+        // Skip spaces
+        while (*endptr == ' ') endptr++;
+
+        const char* macA = endptr;
+
+        // Anti‑replay window
         time_t now = time(nullptr);
-        std::string ts = std::to_string(now);
+        constexpr long ALLOWED_DRIFT = 10; // seconds
+
+        if (labs(now - ts) > ALLOWED_DRIFT) {
+            qCritical() << "Timestamp drift too large, dropping connection";
+            requestInterrupted = true;
+            return;
+        }
+
+        // expected macA = HMAC(session_id, their_guid + timestamp + "A")
+        std::string expectedA = base64url_encode(
+            hmac_sha256(session_id, their_giud.str() + std::to_string(ts) + "A")
+        );
+
+        if (expectedA != macA) {
+            qCritical() << "MAC A mismatch, dropping connection";
+            requestInterrupted = true;
+            return;
+        }
+
+        // Build ACK <macB>
+        std::string min_id = (std::min)(this_guid.str(), their_giud.str());
+        std::string max_id = (std::max)(this_guid.str(), their_giud.str());
+
+        std::string macB = base64url_encode(
+            hmac_sha256(session_id, min_id + max_id + "B")
+        );
 
-        // macA = HMAC(session_id, this_guid + timestamp + "A")
-        std::string macA = base64url_encode(
-            hmac_sha256(session_id, this_guid.str() + ts + "A")
+        std::string ack_msg = "ACK " + macB;
+        send_text(ack_msg.c_str());
+    }
+
+    else if (is_ack) {
+
+        // Format: ACK <macB>
+        const char* macB = message + 4;
+
+        std::string min_id = (std::min)(this_guid.str(), their_giud.str());
+        std::string max_id = (std::max)(this_guid.str(), their_giud.str());
+
+        std::string expectedB = base64url_encode(
+            hmac_sha256(session_id, min_id + max_id + "B")
         );
 
-        // SYN <timestamp> <macA>
-        std::string syn_msg = "SYN " + ts + " " + macA;
-        send_text(syn_msg.c_str());
+        if (expectedB != macB) {
+            qCritical() << "MAC B mismatch, dropping connection";
+            requestInterrupted = true;
+            return;
+        }
+    }
+
+    if (is_syn || is_ack) {
+        if (set_connected()) {
+            /* Start negotiation (exchange SDP and ICE candidates) */
+            if (we_create_offer() && !start_pipeline(TRUE))
+                cleanup_and_quit_loop("ERROR: failed to start pipeline", true);
+        }
+    }
+    else
+        on_server_message(message);
+}
+
 
+class NtfySignalingConnection : public HandshakeSignalingConnection, private NtfySubscriber
+{
+public:
+    NtfySignalingConnection(std::string sid)
+        : HandshakeSignalingConnection(std::move(sid))
+        , topic(topic_prefix + hashed_session_topic(session_id))
+        , topic_url(ntfy_url + topic)
+    {
+    }
+    ~NtfySignalingConnection() override
+    {
+        doClose();
+
+        if (reconnect_count)
+            qDebug() << "Signaling stream reconnected" << reconnect_count << "times, total gap"
+                << total_gap_ms << "ms, longest" << max_gap_ms << "ms";
+
+        // Transfers are gone by the time the next connection uses the pool.
+        if (subscriptions) {
+            for (auto post : posts)
+                subscriptions->http().cancel(post);
+        }
+        posts.clear();
+        outbound.reset();
+        if (subscriptions) {
+            subscriptions->unsubscribe(topic);
+            subscriptions.reset();
+        }
+        if (http_pool)
+            signaling_warmup.give_back(std::move(http_pool));
+    }
+protected:
+    // Queues the message and returns immediately; see OutboundQueue.
+    void transmit(std::string message) override
+    {
+        if (outbound)
+            outbound->push(std::move(message));
+    }
+
+    // ntfy turns anything above 4096 bytes into an attachment.
+    size_t max_message_size() const override { return 3900; }
+
+    void post_message(const std::string& message, std::function<void(bool)> done)
+    {
+        // Started on the subscription's multi handle, so that it is multiplexed
+        // with the SSE stream on its HTTP/2 connection.
+        auto post = std::make_shared<CURL*>(nullptr);
+        *post = subscriptions->http().start(HTTP_POST, topic_url, {}, message, {},
+            [this, post, done](bool ok) {
+                posts.erase(*post);
+                done(ok);
+            });
+        if (!*post) {
+            done(false);
+            return;
+        }
+        posts.insert(*post);
+    }
+
+    /*
+     * Everything runs on the GMainContext of the calling thread - the SendRecv
+     * loop: the SSE stream and the POSTs are driven by socket watches on that
+     * context, so incoming messages reach SendRecv on its own thread.
+     */
+    bool connect_to_server_async() override
+    {
+        connect_started = std::chrono::steady_clock::now();
+
+        subscriptions = shared_subscriptions(warm_start);
+        http_pool = subscriptions->pool();
+
+        outbound = std::make_unique<OutboundQueue>(nullptr,
+            [this](const std::string& message, std::function<void(bool)> done) {
+                post_message(message, std::move(done));
+            });
+
+        subscriptions->subscribe(topic, this);
         return true;
     }
 
@@ -362,32 +598,126 @@ protected:
     {
         doClose();
     }
+    // May be called from any thread; the transfers themselves are torn down
+    // on destruction, which happens on the loop thread.
     void doClose()
     {
         requestInterrupted = true;
-        if (signaling_runner.get_id() != std::this_thread::get_id())
-        {
-            std::call_once(once_closed, [this] {
-                if (signaling_runner.joinable())
-                {
-                    signaling_runner.join();
-                }
-                });
-        }
+        if (outbound)
+            outbound->stop();
     }
 
 private:
-    xg::Guid their_giud;
+    /*
+     * The subscription shared by the connections on the calling thread's
+     * context; it goes away with the last of them. Whether it starts on a
+     * warm connection is reported in is_warm.
+     */
+    static std::shared_ptr<NtfySubscriptions> shared_subscriptions(bool& is_warm)
+    {
+        static std::mutex mtx;
+        static std::map<GMainContext*, std::weak_ptr<NtfySubscriptions>> by_context;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& entry = by_context[g_main_context_get_thread_default()];
+        if (auto subscriptions = entry.lock()) {
+            is_warm = true;
+            return subscriptions;
+        }
 
-    std::thread signaling_runner;
+        auto pool = signaling_warmup.take(is_warm);
+        if (!pool)
+            pool = std::make_shared<HttpPool>();
+        auto subscriptions = std::make_shared<NtfySubscriptions>(ntfy_url, std::move(pool));
+        entry = subscriptions;
+        return subscriptions;
+    }
 
-    std::atomic_bool requestInterrupted = false;
-    std::once_flag once_closed;
+    void on_subscription_message(const char* text) override
+    {
+        if (!requestInterrupted)
+            on_transport_message(text);
+    }
 
-    std::string session_id;
+    /*
+     * After a drop, the subscription resumes from the last event it has seen,
+     * so the session carries on where it was instead of starting over with a
+     * new handshake.
+     */
+    void on_subscription_open() override
+    {
+        if (requestInterrupted)
+            return;
+
+        if (!handshake_started) {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - connect_started).count();
+            qDebug() << "Signaling stream opened in" << elapsed << "ms" << (warm_start ? "(warm)" : "(cold)");
+        }
+
+        if (stream_lost) {
+            const auto gap = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - stream_lost_at).count();
+            total_gap_ms += gap;
+            max_gap_ms = std::max<long long>(max_gap_ms, gap);
+            ++reconnect_count;
+
+            qDebug() << "Signaling stream resumed after" << gap << "ms, reconnects so far:" << reconnect_count;
+
+            stream_lost = false;
+        }
+
+        // A drop before the stream was first opened still needs the handshake.
+        if (!handshake_started) {
+            handshake_started = true;
+            on_transport_open();
+        }
+    }
+
+    void on_subscription_lost() override
+    {
+        if (!stream_lost) {
+            stream_lost = true;
+            stream_lost_at = std::chrono::steady_clock::now();
+            qWarning() << "Signaling stream closed, reconnecting";
+        }
+    }
+
+    const std::string topic;
+    const std::string topic_url;
+
+    bool handshake_started = false;
+
+    bool stream_lost = false;
+    std::chrono::steady_clock::time_point stream_lost_at;
+
+    // Metrics
+    int reconnect_count = 0;
+    long long total_gap_ms = 0;
+    long long max_gap_ms = 0;
+
+    // Shared by the SSE stream and all POSTs; see SignalingWarmup.
+    bool warm_start = false;
+    std::shared_ptr<HttpPool> http_pool;
+    std::chrono::steady_clock::time_point connect_started;
+
+    // Declaration order matters: transfers referencing the others go first on destruction.
+    std::shared_ptr<NtfySubscriptions> subscriptions;
+    std::unique_ptr<OutboundQueue> outbound;
+    std::set<CURL*> posts;              // in flight on subscriptions->http()
 };
 
-std::unique_ptr<ISignalingConnection> get_signaling_connection(std::string sid)
+std::unique_ptr<ISignalingConnection> get_signaling_connection(std::string sid,
+    SignalingTransport transport, const std::string& relay_url)
 {
+    if (transport == SignalingTransport::Loopback)
+        return make_loopback_signaling_connection(std::move(sid));
+    if (transport == SignalingTransport::WebSocket) {
+        if (relay_url.empty()) {
+            qCritical() << "WebSocket signaling selected, but no relay URL is configured";
+            return nullptr;
+        }
+        return make_websocket_signaling_connection(std::move(sid), relay_url);
+    }
     return std::make_unique<NtfySignalingConnection>(std::move(sid));
 }
@@ -9,6 +9,24 @@ struct ISignalingConnection {
     virtual bool we_create_offer() = 0;
     virtual void send_text(const char *text) = 0;
     virtual void close() = 0;
+    // Optional protocol features announced by the peer, e.g. COMPACT_SDP_CAPABILITY.
+    virtual bool peer_has_capability(const char * /*name*/) { return false; }
 };
 
-std::unique_ptr<ISignalingConnection> get_signaling_connection(std::string sid);
+enum class SignalingTransport
+{
+    Ntfy,       // public ntfy.sh relay
+    Loopback,   // both peers on the same host
+    WebSocket,  // WebSocket relay, see relay_url
+};
+
+// Opens the connection to the ntfy relay ahead of the first call.
+void warm_up_signaling();
+
+// Closes that connection; call at exit, once no signaling connection is left.
+void stop_signaling_warmup();
+
+// nullptr if the transport is not configured (WebSocket without a relay URL).
+std::unique_ptr<ISignalingConnection> get_signaling_connection(std::string sid,
+    SignalingTransport transport = SignalingTransport::Ntfy,
+    const std::string& relay_url = {});
@@ -0,0 +1,135 @@
+#include "sse_parser.h"
+
+#include <cstring>
+
+SseParser::SseParser(OnEventFunc on_event)
+    : on_event(std::move(on_event))
+{
+}
+
+void SseParser::reset()
+{
+    partial_line.clear();
+    skip_lf = false;
+    data_view = {};
+    data.clear();
+    data_in_buffer = false;
+    has_data = false;
+    event_type.clear();
+    last_event_id.clear();
+}
+
+void SseParser::feed(const char* chunk, size_t size)
+{
+    const char* p = chunk;
+    const char* const end = chunk + size;
+
+    if (skip_lf && p != end) {
+        if (*p == '\n')
+            ++p;
+        skip_lf = false;
+    }
+
+    while (p != end) {
+        // Lines end with CRLF, LF or CR.
+        const char* eol = p;
+        while (eol != end && *eol != '\n' && *eol != '\r')
+            ++eol;
+
+        if (eol == end) {
+            partial_line.append(p, end - p);
+            break;
+        }
+
+        if (!partial_line.empty()) {
+            partial_line.append(p, eol - p);
+            process_line(partial_line, false);
+            partial_line.clear();
+        }
+        else {
+            process_line(std::string_view(p, eol - p), true);
+        }
+
+        if (*eol == '\r') {
+            if (eol + 1 == end)
+                skip_lf = true;
+            else if (eol[1] == '\n')
+                ++eol;
+        }
+        p = eol + 1;
+    }
+
+    // The chunk is about to go away; keep a pending data line alive.
+    if (has_data && !data_in_buffer) {
+        data.assign(data_view.data(), data_view.size());
+        data_view = {};
+        data_in_buffer = true;
+    }
+}
+
+void SseParser::process_line(std::string_view line, bool in_chunk)
+{
+    if (line.empty()) {
+        dispatch();
+        return;
+    }
+
+    if (line.front() == ':') // comment
+        return;
+
+    std::string_view field = line;
+    std::string_view value;
+    if (auto colon = line.find(':'); colon != std::string_view::npos) {
+        field = line.substr(0, colon);
+        value = line.substr(colon + 1);
+        if (!value.empty() && value.front() == ' ')
+            value.remove_prefix(1);
+    }
+
+    if (field == "data") {
+        if (!has_data) {
+            has_data = true;
+            if (in_chunk) {
+                data_view = value;
+                data_in_buffer = false;
+            }
+            else {
+                data.assign(value.data(), value.size());
+                data_in_buffer = true;
+            }
+        }
+        else {
+            if (!data_in_buffer) {
+                data.assign(data_view.data(), data_view.size());
+                data_view = {};
+                data_in_buffer = true;
+            }
+            data += '\n';
+            data.append(value.data(), value.size());
+        }
+    }
+    else if (field == "event") {
+        event_type.assign(value.data(), value.size());
+    }
+    else if (field == "id") {
+        if (value.find('\0') == std::string_view::npos)
+            last_event_id.assign(value.data(), value.size());
+    }
+    // "retry" and unknown fields are ignored.
+}
+
+void SseParser::dispatch()
+{
+    if (has_data) {
+        const std::string_view payload = data_in_buffer ? std::string_view(data) : data_view;
+        if (on_event)
+            on_event(event_type.empty() ? std::string_view("message") : std::string_view(event_type),
+                payload, last_event_id);
+    }
+
+    data_view = {};
+    data.clear();
+    data_in_buffer = false;
+    has_data = false;
+    event_type.clear();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+/*
+ * Incremental parser for text/event-stream (Server-Sent Events).
+ *
+ * Feed it the chunks exactly as they come off the wire: events split across
+ * chunks are stitched together, and any number of events per chunk are
+ * dispatched in order. Complete lines are parsed in place; bytes are only
+ * copied when a line or an event straddles a chunk boundary, or when an
+ * event carries several data lines.
+ */
+class SseParser
+{
+public:
+    // 'data' and 'id' are only valid for the duration of the call.
+    typedef std::function<void(std::string_view event, std::string_view data, std::string_view id)> OnEventFunc;
+
+    explicit SseParser(OnEventFunc on_event);
+
+    void feed(const char* chunk, size_t size);
+    void reset();
+
+private:
+    void process_line(std::string_view line, bool in_chunk);
+    void dispatch();
+
+    OnEventFunc on_event;
+
+    std::string partial_line;       // incomplete line carried over to the next chunk
+    bool skip_lf = false;           // previous chunk ended with '\r'
+
+    std::string_view data_view;     // single data line still inside the current chunk
+    std::string data;               // data lines that had to be copied
+    bool data_in_buffer = false;
+    bool has_data = false;
+
+    std::string event_type;
+    std::string last_event_id;
+};
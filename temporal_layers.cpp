@@ -0,0 +1,130 @@
+#include "temporal_layers.h"
+
+#include <algorithm>
+#include <string>
+
+namespace {
+
+/*
+ * The patterns, one entry per frame of the period: the frame's layer, its
+ * vp8enc flags and whether it depends on the base layer only.
+ *
+ * Base frames refer to and update the last frame. In the 3 layer pattern the
+ * middle layer keeps its frame in the golden buffer, for the top layer frame
+ * that follows it.
+ */
+struct PatternFrame
+{
+    int layer;
+    const char* flags;
+    bool sync;
+};
+
+#define BASE_FLAGS "no-ref-golden+no-ref-alt+no-upd-golden+no-upd-alt"
+#define DROPPABLE_FLAGS "no-ref-golden+no-ref-alt+no-upd-last+no-upd-golden+no-upd-alt+no-upd-entropy"
+
+const PatternFrame two_layers[] = {
+    { 0, BASE_FLAGS, true },
+    { 1, DROPPABLE_FLAGS, true },
+};
+
+const PatternFrame three_layers[] = {
+    { 0, BASE_FLAGS, true },
+    { 2, DROPPABLE_FLAGS, true },
+    { 1, "no-ref-golden+no-ref-alt+no-upd-last+no-upd-alt+no-upd-entropy", true },
+    { 2, "no-ref-alt+no-upd-last+no-upd-golden+no-upd-alt+no-upd-entropy", false },
+};
+
+// Cumulative, as libvpx takes them; the split of its examples.
+const double two_layer_shares[] = { 0.6, 1.0 };
+const double three_layer_shares[] = { 0.4, 0.6, 1.0 };
+
+std::string bitrates(int layers, guint bitrate)
+{
+    std::string result = "<";
+    for (int i = 0; i < layers; ++i) {
+        if (i)
+            result += ',';
+        result += std::to_string(static_cast<guint>(bitrate * temporal_layer_share(layers, i)));
+    }
+    return result + '>';
+}
+
+} // namespace
+
+double temporal_layer_share(int layers, int layer)
+{
+    if (layers == 2)
+        return two_layer_shares[std::clamp(layer, 0, 1)];
+    if (layers == 3)
+        return three_layer_shares[std::clamp(layer, 0, 2)];
+    return 1.0;
+}
+
+void set_temporal_layers(ElementSpec& spec, int layers, guint bitrate)
+{
+    const PatternFrame* pattern = layers == 3 ? three_layers : two_layers;
+    const int periodicity = layers == 3 ? G_N_ELEMENTS(three_layers) : G_N_ELEMENTS(two_layers);
+
+    std::string ids = "<", flags = "<", sync = "<";
+    for (int i = 0; i < periodicity; ++i) {
+        const char* separator = i ? "," : "";
+        ids += separator + std::to_string(pattern[i].layer);
+        flags += std::string(separator) + "(GstVPXEncTsFlags)" + pattern[i].flags;
+        sync += std::string(separator) + (pattern[i].sync ? "true" : "false");
+    }
+
+    spec.set("temporal-scalability-number-layers", std::to_string(layers))
+        .set("temporal-scalability-periodicity", std::to_string(periodicity))
+        .set("temporal-scalability-rate-decimator", layers == 3 ? "<4,2,1>" : "<2,1>")
+        .set("temporal-scalability-layer-id", ids + '>')
+        .set("temporal-scalability-layer-flags", flags + '>')
+        .set("temporal-scalability-layer-sync-flags", sync + '>')
+        .set("temporal-scalability-target-bitrate", bitrates(layers, bitrate));
+}
+
+void set_temporal_layer_bitrates(GstElement* encoder, int layers, guint bitrate)
+{
+    G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+    auto array = g_value_array_new(layers);
+    for (int i = 0; i < layers; ++i) {
+        GValue value = G_VALUE_INIT;
+        g_value_init(&value, G_TYPE_INT);
+        g_value_set_int(&value, static_cast<gint>(bitrate * temporal_layer_share(layers, i)));
+        g_value_array_append(array, &value);
+        g_value_unset(&value);
+    }
+    g_object_set(encoder,
+        "temporal-scalability-target-bitrate", array,
+        "target-bitrate", static_cast<gint>(bitrate),
+        nullptr);
+    g_value_array_free(array);
+    G_GNUC_END_IGNORE_DEPRECATIONS
+}
+
+int temporal_layer_of(GstBuffer* buffer)
+{
+    auto meta = buffer ? gst_buffer_get_custom_meta(buffer, "GstVP8Meta") : nullptr;
+    if (!meta)
+        return -1;
+    guint layer = 0;
+    if (!gst_structure_get_uint(gst_custom_meta_get_structure(meta), "layer-id", &layer))
+        return -1;
+    return static_cast<int>(layer);
+}
+
+TemporalLayerTarget temporal_layer_target(int layers, int layers_sent, guint available,
+    guint min_quality_bitrate, guint min_bitrate, guint max_bitrate)
+{
+    TemporalLayerTarget result;
+    for (int sent = layers; sent >= 1; --sent) {
+        const auto bitrate = static_cast<guint>(available / temporal_layer_share(layers, sent - 1));
+        const auto needed = sent > layers_sent ? min_quality_bitrate / 4 * 5 : min_quality_bitrate;
+        if (bitrate >= needed || sent == 1) {
+            result.layers_sent = sent;
+            result.encoder_bitrate = std::clamp(bitrate, min_bitrate, max_bitrate);
+            break;
+        }
+    }
+    return result;
+}
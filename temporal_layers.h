@@ -0,0 +1,47 @@
+#pragma once
+
+#include "pipeline_builder.h"
+
+#include <gst/gst.h>
+
+/*
+ * Temporal scalability of the VP8 encoder.
+ *
+ * With 2 or 3 temporal layers, a frame of an enhancement layer refers only
+ * to frames of lower layers, and only the base layer updates the entropy
+ * context. So the frames of the top layers can be left out and the rest
+ * still decodes: each layer left out halves the frame rate, without a
+ * keyframe and without reconfiguring the encoder.
+ *
+ * vp8enc tags each frame with its layer (GstVP8Meta); rtpvp8pay carries the
+ * layer in the payload descriptor (TID, Y, TL0PICIDX) next to the 15-bit
+ * picture id.
+ */
+
+enum { MAX_TEMPORAL_LAYERS = 3 };
+
+// Share of the bitrate taken by layers 0..layer together.
+double temporal_layer_share(int layers, int layer);
+
+// Adds the temporal-scalability-* properties for 2 or 3 layers to a vp8enc
+// spec, with 'bitrate' shared between the layers.
+void set_temporal_layers(ElementSpec& spec, int layers, guint bitrate);
+
+// Retargets a vp8enc that was configured with set_temporal_layers().
+void set_temporal_layer_bitrates(GstElement* encoder, int layers, guint bitrate);
+
+// The temporal layer of a frame encoded with layers; -1 if it is not tagged.
+int temporal_layer_of(GstBuffer* buffer);
+
+struct TemporalLayerTarget
+{
+    int layers_sent = 1;
+    guint encoder_bitrate = 0;      // of all the layers, sent or not
+};
+
+// How many layers to send over 'available' bits/s, and the encoder bitrate
+// for that. Below min_quality_bitrate for all the layers, the top layers are
+// left out rather than every frame getting worse; adding one back takes a
+// quarter more than that, so that a wavering estimate does not flip it.
+TemporalLayerTarget temporal_layer_target(int layers, int layers_sent, guint available,
+    guint min_quality_bitrate, guint min_bitrate, guint max_bitrate);
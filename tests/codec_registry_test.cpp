@@ -0,0 +1,134 @@
+#include "codec_registry.h"
+
+#include <gst/gst.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+ * Which video codec we answer an offer with (choose_offered_video_codec()).
+ * Preferences and installed encoders are given, not read from the settings
+ * and the registry, so the result does not depend on the plugins at hand.
+ */
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+// An offer with the given m-lines, e.g. { "video 96:VP8 102:H264" }.
+GstSDPMessage* make_offer(const std::vector<std::string>& medias)
+{
+    std::string text = "v=0\r\no=- 0 0 IN IP4 0.0.0.0\r\ns=-\r\nt=0 0\r\n";
+    for (const auto& media : medias) {
+        const auto kind = media.substr(0, media.find(' '));
+        std::string formats, attributes;
+        size_t pos = kind.size();
+        while (pos < media.size()) {
+            const auto begin = media.find_first_not_of(' ', pos);
+            if (begin == std::string::npos)
+                break;
+            auto end = media.find(' ', begin);
+            if (end == std::string::npos)
+                end = media.size();
+            const auto format = media.substr(begin, end - begin);
+            const auto colon = format.find(':');
+            const auto pt = format.substr(0, colon);
+            formats += ' ' + pt;
+            attributes += "a=rtpmap:" + pt + ' ' + format.substr(colon + 1)
+                + (kind == "audio" ? "/48000/2" : "/90000") + "\r\n";
+            pos = end;
+        }
+        text += "m=" + kind + " 9 UDP/TLS/RTP/SAVPF" + formats + "\r\n" + attributes;
+    }
+
+    GstSDPMessage* sdp = nullptr;
+    gst_sdp_message_new(&sdp);
+    gst_sdp_message_parse_buffer(reinterpret_cast<const guint8*>(text.data()), static_cast<guint>(text.size()), sdp);
+    return sdp;
+}
+
+const VideoCodec* codec(const char* name)
+{
+    return find_video_codec(name);
+}
+
+bool can_send_all(const VideoCodec&)
+{
+    return true;
+}
+
+bool can_send_none(const VideoCodec&)
+{
+    return false;
+}
+
+// The chosen codec's name and payload type, "VP8/96", or "none".
+std::string choose(const std::vector<std::string>& medias, const std::vector<const VideoCodec*>& preferred,
+    bool (*can_send)(const VideoCodec&))
+{
+    auto sdp = make_offer(medias);
+    int payload_type = -1;
+    auto chosen = choose_offered_video_codec(sdp, preferred, can_send, payload_type);
+    gst_sdp_message_free(sdp);
+    return chosen ? std::string(chosen->encoding_name) + '/' + std::to_string(payload_type) : "none";
+}
+
+void expect(const std::string& actual, const char* expected, const char* what)
+{
+    if (actual != expected)
+        fprintf(stderr, "%s: got %s, expected %s\n", what, actual.c_str(), expected);
+    check(actual == expected, what);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    gst_init(&argc, &argv);
+
+    const std::vector<std::string> browser = { "video 96:VP8 98:VP9 102:H264" };
+
+    expect(choose(browser, { codec("H264"), codec("VP8") }, can_send_all), "H264/102",
+        "our preference order wins over the offer's");
+
+    expect(choose(browser, {}, can_send_all), "VP8/96",
+        "without preferences, the offer's order");
+
+    expect(choose(browser, { codec("AV1") }, can_send_all), "VP8/96",
+        "a preferred codec not offered falls back to the offer's order");
+
+    expect(choose({ "video 120:VP9 121:VP8" }, { codec("VP8") }, can_send_all), "VP8/121",
+        "the offer's payload type is kept");
+
+    expect(choose({ "video 100:FOO 101:VP9" }, {}, can_send_all), "VP9/101",
+        "unknown codecs are skipped");
+
+    expect(choose({ "video 100:FOO" }, { codec("VP8") }, can_send_all), "none",
+        "nothing we know of");
+
+    expect(choose({ "audio 111:OPUS", "video 102:H264" }, {}, can_send_all), "H264/102",
+        "the video m-line after an audio one");
+
+    expect(choose({ "video 96:VP8", "video 102:H264" }, { codec("H264") }, can_send_all), "VP8/96",
+        "only the first video m-line");
+
+    expect(choose(browser, {}, can_send_none), "none",
+        "nothing we can send");
+
+    expect(choose(browser, { codec("VP9") }, can_send_none), "VP9/98",
+        "preferred codecs are taken as sendable");
+
+    if (failures)
+        return 1;
+    printf("codec_registry_test: all passed\n");
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include "sse_parser.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Feeds recorded ntfy SSE streams through SseParser in random chunk splits,
+ * checks the events against a whole-stream reference parse and reports the
+ * throughput.
+ *
+ *   sse_parser_bench <directory with *.sse files> [seed]
+ *
+ * Exits non-zero if any split yields different events.
+ */
+
+namespace {
+
+const int CHECKED_SPLITS = 2000;
+const double TIMED_SECONDS = 0.5;
+const size_t MAX_CHUNK = 4096;
+
+struct Event
+{
+    std::string type;
+    std::string data;
+    std::string id;
+
+    bool operator ==(const Event& other) const
+    {
+        return type == other.type && data == other.data && id == other.id;
+    }
+};
+
+// Deliberately naive: whole stream in memory, one line at a time.
+std::vector<Event> reference_parse(const std::string& stream)
+{
+    std::vector<Event> events;
+    std::string type, data, id;
+    bool has_data = false;
+
+    size_t pos = 0;
+    while (pos < stream.size()) {
+        size_t eol = stream.find_first_of("\r\n", pos);
+        if (eol == std::string::npos)
+            break;                      // an unterminated line is never dispatched
+        const std::string line = stream.substr(pos, eol - pos);
+        pos = eol + (stream.compare(eol, 2, "\r\n") == 0 ? 2 : 1);
+
+        if (line.empty()) {
+            if (has_data)
+                events.push_back({ type.empty() ? "message" : type, data, id });
+            type.clear();
+            data.clear();
+            has_data = false;
+            continue;
+        }
+        if (line[0] == ':')
+            continue;
+
+        const auto colon = line.find(':');
+        const std::string field = line.substr(0, colon);
+        std::string value = colon == std::string::npos ? std::string() : line.substr(colon + 1);
+        if (!value.empty() && value[0] == ' ')
+            value.erase(0, 1);
+
+        if (field == "data") {
+            data += (has_data ? "\n" : "") + value;
+            has_data = true;
+        } else if (field == "event") {
+            type = value;
+        } else if (field == "id") {
+            id = value;
+        }
+    }
+    return events;
+}
+
+std::vector<size_t> random_split(size_t size, std::mt19937& rng)
+{
+    // Mostly network sized chunks, with single bytes and tiny pieces mixed in
+    // so that every kind of boundary comes up.
+    std::uniform_int_distribution<int> kind(0, 9);
+    std::uniform_int_distribution<size_t> small(1, 8);
+    std::uniform_int_distribution<size_t> large(1, MAX_CHUNK);
+
+    std::vector<size_t> chunks;
+    for (size_t done = 0; done < size; ) {
+        const int k = kind(rng);
+        size_t n = k == 0 ? 1 : k < 4 ? small(rng) : large(rng);
+        n = std::min(n, size - done);
+        chunks.push_back(n);
+        done += n;
+    }
+    return chunks;
+}
+
+bool check_file(const std::filesystem::path& path, std::mt19937& rng)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    const std::string stream = buffer.str();
+
+    const auto expected = reference_parse(stream);
+    if (expected.empty()) {
+        std::printf("%s: no events in the recording\n", path.filename().string().c_str());
+        return false;
+    }
+
+    std::vector<Event> events;
+    SseParser parser([&events](std::string_view type, std::string_view data, std::string_view id) {
+        events.push_back({ std::string(type), std::string(data), std::string(id) });
+    });
+
+    for (int i = 0; i < CHECKED_SPLITS; ++i) {
+        events.clear();
+        parser.reset();
+        size_t offset = 0;
+        for (auto n : random_split(stream.size(), rng)) {
+            parser.feed(stream.data() + offset, n);
+            offset += n;
+        }
+        if (events != expected) {
+            std::printf("%s: split %d gave %zu events, expected %zu\n",
+                path.filename().string().c_str(), i, events.size(), expected.size());
+            return false;
+        }
+    }
+
+    // Throughput over fixed splits, with a callback that only counts.
+    size_t dispatched = 0;
+    SseParser counting([&dispatched](std::string_view, std::string_view, std::string_view) { ++dispatched; });
+    const auto chunks = random_split(stream.size(), rng);
+
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    size_t passes = 0;
+    double seconds = 0;
+    do {
+        counting.reset();
+        size_t offset = 0;
+        for (auto n : chunks) {
+            counting.feed(stream.data() + offset, n);
+            offset += n;
+        }
+        ++passes;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (seconds < TIMED_SECONDS);
+
+    std::printf("%-24s %6zu bytes %4zu events, %d splits ok: %8.1f MB/s, %10.0f events/s\n",
+        path.filename().string().c_str(), stream.size(), expected.size(), CHECKED_SPLITS,
+        stream.size() * passes / seconds / 1e6, dispatched / seconds);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <directory with *.sse files> [seed]\n", argv[0]);
+        return 2;
+    }
+
+    const unsigned seed = argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10))
+        : std::random_device()();
+    std::printf("seed %u\n", seed);
+    std::mt19937 rng(seed);
+
+    std::vector<std::filesystem::path> files;
+    for (const auto& entry : std::filesystem::directory_iterator(argv[1])) {
+        if (entry.path().extension() == ".sse")
+            files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+    if (files.empty()) {
+        std::fprintf(stderr, "No *.sse files in %s\n", argv[1]);
+        return 2;
+    }
+
+    bool ok = true;
+    for (const auto& file : files)
+        ok = check_file(file, rng) && ok;
+    return ok ? 0 : 1;
+}
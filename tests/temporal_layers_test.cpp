@@ -0,0 +1,85 @@
+#include "temporal_layers.h"
+
+#include <cstdio>
+#include <vector>
+
+/*
+ * How many VP8 temporal layers are sent for a bandwidth estimate
+ * (temporal_layer_target()): the top layers go when all of them would fall
+ * below the minimum quality bitrate, and come back only a quarter above it.
+ */
+
+namespace {
+
+const guint MIN_QUALITY = 400000;
+const guint MIN_BITRATE = 100000;
+const guint MAX_BITRATE = 5000000;
+
+int failures = 0;
+
+TemporalLayerTarget target(int layers, int layers_sent, guint available)
+{
+    return temporal_layer_target(layers, layers_sent, available, MIN_QUALITY, MIN_BITRATE, MAX_BITRATE);
+}
+
+// The encoder bitrate is a division by a layer share; allow for rounding.
+void expect(const TemporalLayerTarget& actual, int layers_sent, guint encoder_bitrate, const char* what)
+{
+    const auto difference = actual.encoder_bitrate > encoder_bitrate
+        ? actual.encoder_bitrate - encoder_bitrate : encoder_bitrate - actual.encoder_bitrate;
+    if (actual.layers_sent != layers_sent || difference > 1) {
+        fprintf(stderr, "FAILED: %s: got %d layers at %u bits/s, expected %d at %u\n", what,
+            actual.layers_sent, actual.encoder_bitrate, layers_sent, encoder_bitrate);
+        ++failures;
+    }
+}
+
+} // namespace
+
+int main()
+{
+    // Shares of 3 layers: 40%, 60%, 100%.
+    expect(target(3, 3, 1000000), 3, 1000000, "all the layers above the minimum");
+    expect(target(3, 3, 400000), 3, 400000, "all the layers at the minimum");
+    expect(target(3, 3, 399000), 2, 665000, "the top layer goes below the minimum");
+    expect(target(3, 3, 150000), 1, 375000, "both enhancement layers go");
+
+    // Hysteresis: the same estimate keeps what is being sent.
+    expect(target(3, 2, 450000), 2, 750000, "a layer comes back only a quarter above the minimum");
+    expect(target(3, 3, 450000), 3, 450000, "but is kept there once sent");
+    expect(target(3, 2, 500000), 3, 500000, "and comes back at a quarter above");
+    expect(target(3, 1, 180000), 1, 450000, "the base layer alone, short of 2 with margin");
+    expect(target(3, 2, 180000), 1, 450000, "2 layers drop to 1 below the minimum");
+    expect(target(3, 1, 600000), 3, 600000, "back to all the layers in one step");
+
+    // A wavering estimate around the minimum does not flip the layers.
+    {
+        const std::vector<guint> estimates = { 420000, 390000, 480000, 395000, 490000, 410000, 510000 };
+        const std::vector<int> expected = { 3, 2, 2, 2, 2, 2, 3 };
+        int sent = 3;
+        for (size_t i = 0; i < estimates.size(); ++i) {
+            sent = target(3, sent, estimates[i]).layers_sent;
+            if (sent != expected[i]) {
+                fprintf(stderr, "FAILED: wavering estimate: %d layers at step %zu, expected %d\n",
+                    sent, i, expected[i]);
+                ++failures;
+                break;
+            }
+        }
+    }
+
+    // Shares of 2 layers: 60%, 100%.
+    expect(target(2, 2, 390000), 1, 650000, "2 layers: the top one goes");
+    expect(target(2, 1, 450000), 1, 750000, "2 layers: not back short of the margin");
+    expect(target(2, 1, 500000), 2, 500000, "2 layers: back with the margin");
+
+    // The encoder bitrate stays within its bounds.
+    expect(target(3, 3, 10000000), 3, MAX_BITRATE, "capped at the maximum");
+    expect(target(3, 3, 10000), 1, MIN_BITRATE, "raised to the minimum");
+    expect(target(1, 1, 300000), 1, 300000, "one layer: the estimate as is");
+
+    if (failures)
+        return 1;
+    printf("temporal_layers_test: all passed\n");
+    return 0;
+}
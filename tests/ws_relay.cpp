@@ -0,0 +1,281 @@
+#include <gio/gio.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+/*
+ * A WebSocket relay for trying out WebSocket signaling locally.
+ *
+ *   ws_relay [port]
+ *
+ * Every text message a client sends goes to all the other clients connected
+ * with the same path; the peers of a call share the path derived from their
+ * session id. Set the relay URL in Preferences to ws://127.0.0.1:<port>/.
+ *
+ * One thread per client, plain ws:// only, no extensions. Not meant to face
+ * the internet.
+ */
+
+namespace {
+
+const guint16 DEFAULT_PORT = 8765;
+const guint64 MAX_MESSAGE_SIZE = 1 << 20;
+const char WEBSOCKET_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+enum Opcode
+{
+    CONTINUATION = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xA,
+};
+
+struct Client
+{
+    GOutputStream* output = nullptr;
+    std::mutex write_mtx;
+
+    bool send(int opcode, const std::string& payload)
+    {
+        std::string frame(1, static_cast<char>(0x80 | opcode));
+        const guint64 size = payload.size();
+        if (size < 126) {
+            frame += static_cast<char>(size);
+        } else if (size < 65536) {
+            frame += static_cast<char>(126);
+            frame += static_cast<char>(size >> 8);
+            frame += static_cast<char>(size & 0xff);
+        } else {
+            frame += static_cast<char>(127);
+            for (int shift = 56; shift >= 0; shift -= 8)
+                frame += static_cast<char>((size >> shift) & 0xff);
+        }
+        frame += payload;
+
+        std::lock_guard<std::mutex> lock(write_mtx);
+        return g_output_stream_write_all(output, frame.data(), frame.size(), nullptr, nullptr, nullptr);
+    }
+};
+
+// Clients by path. Held while relaying, so that a client cannot go away
+// while a message is being written to it.
+std::mutex rooms_mtx;
+std::map<std::string, std::set<Client*>> rooms;
+
+void relay(const std::string& path, Client* sender, const std::string& message)
+{
+    std::lock_guard<std::mutex> lock(rooms_mtx);
+    for (auto client : rooms[path]) {
+        if (client != sender)
+            client->send(TEXT, message);
+    }
+}
+
+bool read_exact(GInputStream* input, void* buffer, gsize size)
+{
+    gsize read = 0;
+    return g_input_stream_read_all(input, buffer, size, &read, nullptr, nullptr) && read == size;
+}
+
+// The upgrade request: its path and Sec-WebSocket-Key.
+bool read_handshake(GDataInputStream* input, std::string& path, std::string& key)
+{
+    for (bool first = true; ; first = false) {
+        gsize length = 0;
+        auto line = g_data_input_stream_read_line(input, &length, nullptr, nullptr);
+        if (!line)
+            return false;
+        const std::string text(line, length);
+        g_free(line);
+
+        if (text.empty())
+            return !path.empty() && !key.empty();
+
+        if (first) {
+            // GET /path HTTP/1.1
+            const auto begin = text.find(' ');
+            const auto end = text.rfind(' ');
+            if (text.compare(0, 4, "GET ") != 0 || begin == end)
+                return false;
+            path = text.substr(begin + 1, end - begin - 1);
+            continue;
+        }
+
+        const auto colon = text.find(':');
+        if (colon != std::string::npos
+                && !g_ascii_strcasecmp(text.substr(0, colon).c_str(), "Sec-WebSocket-Key")) {
+            key = text.substr(colon + 1);
+            key.erase(0, key.find_first_not_of(' '));
+            key.erase(key.find_last_not_of(' ') + 1);
+        }
+    }
+}
+
+std::string accept_key(const std::string& key)
+{
+    const std::string text = key + WEBSOCKET_GUID;
+
+    guint8 digest[20];
+    gsize digest_size = sizeof(digest);
+    auto checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(checksum, reinterpret_cast<const guchar*>(text.data()), text.size());
+    g_checksum_get_digest(checksum, digest, &digest_size);
+    g_checksum_free(checksum);
+
+    auto encoded = g_base64_encode(digest, digest_size);
+    std::string result(encoded);
+    g_free(encoded);
+    return result;
+}
+
+// Reads frames until the client closes; relays the text messages.
+void serve(GInputStream* input, Client& client, const std::string& path)
+{
+    std::string message;
+    int message_opcode = -1;
+
+    for (;;) {
+        guint8 header[2];
+        if (!read_exact(input, header, sizeof(header)))
+            return;
+
+        const bool fin = header[0] & 0x80;
+        const int opcode = header[0] & 0x0f;
+        const bool masked = header[1] & 0x80;
+        guint64 size = header[1] & 0x7f;
+
+        if (size >= 126) {
+            guint8 extended[8];
+            const int bytes = size == 126 ? 2 : 8;
+            if (!read_exact(input, extended, bytes))
+                return;
+            size = 0;
+            for (int i = 0; i < bytes; ++i)
+                size = (size << 8) | extended[i];
+        }
+        if (!masked || size > MAX_MESSAGE_SIZE)
+            return;                     // clients must mask; and nothing is that big
+
+        guint8 mask[4];
+        std::string payload(size, '\0');
+        if (!read_exact(input, mask, sizeof(mask)) || (size && !read_exact(input, &payload[0], size)))
+            return;
+        for (guint64 i = 0; i < size; ++i)
+            payload[i] ^= mask[i % 4];
+
+        switch (opcode) {
+        case CLOSE:
+            client.send(CLOSE, payload.substr(0, 2));
+            return;
+        case PING:
+            client.send(PONG, payload);
+            continue;
+        case PONG:
+            continue;
+        case TEXT:
+        case BINARY:
+            message = std::move(payload);
+            message_opcode = opcode;
+            break;
+        case CONTINUATION:
+            if (message_opcode < 0 || message.size() + payload.size() > MAX_MESSAGE_SIZE)
+                return;
+            message += payload;
+            break;
+        default:
+            return;
+        }
+
+        if (fin) {
+            if (message_opcode == TEXT)
+                relay(path, &client, message);
+            message.clear();
+            message_opcode = -1;
+        }
+    }
+}
+
+gboolean on_run(GThreadedSocketService*, GSocketConnection* connection, GObject*, gpointer)
+{
+    auto input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    g_data_input_stream_set_newline_type(input, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+
+    Client client;
+    client.output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+
+    std::string path, key;
+    if (read_handshake(input, path, key)) {
+        const std::string response =
+            "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: " + accept_key(key) + "\r\n\r\n";
+
+        if (g_output_stream_write_all(client.output, response.data(), response.size(), nullptr, nullptr, nullptr)) {
+            size_t clients;
+            {
+                std::lock_guard<std::mutex> lock(rooms_mtx);
+                rooms[path].insert(&client);
+                clients = rooms[path].size();
+            }
+            g_print("%s: client joined, %zu connected\n", path.c_str(), clients);
+
+            serve(G_INPUT_STREAM(input), client, path);
+
+            {
+                std::lock_guard<std::mutex> lock(rooms_mtx);
+                rooms[path].erase(&client);
+                clients = rooms[path].size();
+                if (!clients)
+                    rooms.erase(path);
+            }
+            g_print("%s: client left, %zu connected\n", path.c_str(), clients);
+        }
+    } else {
+        const char response[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+        g_output_stream_write_all(client.output, response, sizeof(response) - 1, nullptr, nullptr, nullptr);
+    }
+
+    g_object_unref(input);
+    g_io_stream_close(G_IO_STREAM(connection), nullptr, nullptr);
+    return TRUE;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    const auto port = argc > 1 ? static_cast<guint16>(atoi(argv[1])) : DEFAULT_PORT;
+
+    auto service = g_threaded_socket_service_new(-1);
+
+    GError* error = nullptr;
+    auto address = g_inet_socket_address_new_from_string("127.0.0.1", port);
+    const bool ok = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+        G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, nullptr, nullptr, &error);
+    g_object_unref(address);
+    if (!ok) {
+        g_printerr("Cannot listen on port %u: %s\n", port, error->message);
+        g_error_free(error);
+        g_object_unref(service);
+        return 1;
+    }
+
+    g_signal_connect(service, "run", G_CALLBACK(on_run), nullptr);
+    g_socket_service_start(G_SOCKET_SERVICE(service));
+    g_print("WebSocket relay on ws://127.0.0.1:%u/\n", port);
+
+    auto loop = g_main_loop_new(nullptr, false);
+    g_main_loop_run(loop);
+    g_main_loop_unref(loop);
+    g_object_unref(service);
+    return 0;
+}
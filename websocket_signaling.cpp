@@ -0,0 +1,334 @@
+#include "signaling_base.h"
+
+#include "http.h"
+
+#include <curl/websockets.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace {
+
+// Older curl versions take a non-const frame pointer in curl_ws_recv().
+struct WsFrameOut
+{
+    const curl_ws_frame* meta = nullptr;
+    operator const curl_ws_frame**() { return &meta; }
+    operator curl_ws_frame**() { return const_cast<curl_ws_frame**>(&meta); }
+};
+
+/*
+ * Signaling over a single WebSocket to a relay that forwards every text
+ * message to the other clients connected to the same path.
+ *
+ * Both directions share one connection, so a message costs one frame instead
+ * of a full HTTP request. The socket is watched on the thread-default
+ * GMainContext of the thread calling connect_to_server_async().
+ */
+class WebSocketSignalingConnection : public HandshakeSignalingConnection
+{
+public:
+    enum { RECONNECT_BASE_DELAY_MS = 250, RECONNECT_MAX_DELAY_MS = 30000 };
+
+    WebSocketSignalingConnection(std::string sid, const std::string& relay_url)
+        : HandshakeSignalingConnection(std::move(sid))
+    {
+        url = relay_url;
+        if (!url.empty() && url.back() != '/')
+            url += '/';
+        url += hashed_session_topic(session_id);
+    }
+
+    ~WebSocketSignalingConnection() override
+    {
+        close();
+
+        if (reconnect_timer) {
+            g_source_destroy(reconnect_timer);
+            g_source_unref(reconnect_timer);
+        }
+
+        disconnect(true);
+        outbound.reset();
+        multi.reset();
+    }
+
+    bool connect_to_server_async() override
+    {
+        context = g_main_context_get_thread_default();
+
+        multi = std::make_unique<HttpMulti>(nullptr);
+
+        outbound = std::make_unique<OutboundQueue>(nullptr,
+            [this](const std::string& message, std::function<void(bool)> done) {
+                send_frame(message, std::move(done));
+            });
+
+        return start_connect();
+    }
+
+    void close() override
+    {
+        requestInterrupted = true;
+        if (outbound)
+            outbound->stop();
+    }
+
+protected:
+    void transmit(std::string message) override
+    {
+        if (outbound)
+            outbound->push(std::move(message));
+    }
+
+private:
+    bool start_connect()
+    {
+        connecting = multi->connect(url, {}, [this](CURL* curl) {
+            connecting = nullptr;
+            if (curl)
+                on_connected(curl);
+            else
+                on_connection_lost();
+        });
+
+        if (!connecting) {
+            qCritical() << "Cannot start WebSocket signaling connection";
+            return false;
+        }
+        return true;
+    }
+
+    void on_connected(CURL* handle)
+    {
+        curl = handle;
+
+        curl_socket_t fd = CURL_SOCKET_BAD;
+        curl_easy_getinfo(curl, CURLINFO_ACTIVESOCKET, &fd);
+        if (fd == CURL_SOCKET_BAD) {
+            on_connection_lost();
+            return;
+        }
+
+#ifdef _WIN32
+        channel = g_io_channel_win32_new_socket(static_cast<gint>(fd));
+#else
+        channel = g_io_channel_unix_new(fd);
+#endif
+        read_watch = g_io_create_watch(channel, static_cast<GIOCondition>(G_IO_IN | G_IO_ERR | G_IO_HUP));
+        g_source_set_callback(read_watch, (GSourceFunc) on_readable, this, nullptr);
+        g_source_attach(read_watch, context);
+
+        if (reconnect_attempts) {
+            qDebug() << "WebSocket signaling reconnected after" << reconnect_attempts << "attempts";
+            reconnect_attempts = 0;
+        }
+
+        if (!handshake_started) {
+            handshake_started = true;
+            on_transport_open();
+        }
+
+        // The upgrade response may have been followed by frames curl already holds.
+        receive();
+    }
+
+    void disconnect(bool graceful)
+    {
+        if (write_watch) {
+            g_source_destroy(write_watch);
+            g_source_unref(write_watch);
+            write_watch = nullptr;
+        }
+        if (read_watch) {
+            g_source_destroy(read_watch);
+            g_source_unref(read_watch);
+            read_watch = nullptr;
+        }
+        if (channel) {
+            g_io_channel_unref(channel);
+            channel = nullptr;
+        }
+        if (curl) {
+            if (graceful) {
+                size_t sent = 0;
+                curl_ws_send(curl, "", 0, &sent, 0, CURLWS_CLOSE);
+            }
+            curl_easy_cleanup(curl);
+            curl = nullptr;
+        }
+        if (connecting) {
+            multi->cancel(connecting);
+            connecting = nullptr;
+        }
+
+        incoming.clear();
+
+        if (pending_done) {
+            auto done = std::move(pending_done);
+            pending_done = nullptr;
+            pending_frame.clear();
+            done(false);
+        }
+    }
+
+    void on_connection_lost()
+    {
+        disconnect(false);
+
+        if (requestInterrupted)
+            return;
+
+        qCritical() << "WebSocket signaling connection lost, reconnecting";
+
+        const auto delay = std::min<guint>(RECONNECT_MAX_DELAY_MS,
+            RECONNECT_BASE_DELAY_MS << std::min(reconnect_attempts, 8));
+        ++reconnect_attempts;
+
+        reconnect_timer = g_timeout_source_new(delay);
+        g_source_set_callback(reconnect_timer, on_reconnect_timer, this, nullptr);
+        g_source_attach(reconnect_timer, context);
+    }
+
+    static gboolean on_reconnect_timer(gpointer data)
+    {
+        auto self = static_cast<WebSocketSignalingConnection*>(data);
+
+        g_source_unref(self->reconnect_timer);
+        self->reconnect_timer = nullptr;
+
+        if (!self->requestInterrupted && !self->start_connect())
+            self->on_connection_lost();
+
+        return G_SOURCE_REMOVE;
+    }
+
+    static gboolean on_readable(GIOChannel*, GIOCondition, gpointer data)
+    {
+        static_cast<WebSocketSignalingConnection*>(data)->receive();
+        return G_SOURCE_CONTINUE;
+    }
+
+    // Drains everything curl can deliver without blocking.
+    void receive()
+    {
+        char buffer[4096];
+        while (curl && !requestInterrupted) {
+            size_t received = 0;
+            WsFrameOut frame;
+            const CURLcode res = curl_ws_recv(curl, buffer, sizeof(buffer), &received, frame);
+            const auto meta = frame.meta;
+
+            if (res == CURLE_AGAIN)
+                return;
+
+            if (res != CURLE_OK || !meta || (meta->flags & CURLWS_CLOSE)) {
+                on_connection_lost();
+                return;
+            }
+
+            if (!(meta->flags & CURLWS_TEXT))
+                continue; // pings are answered by curl, binary data is not ours
+
+            incoming.append(buffer, received);
+
+            if (meta->bytesleft == 0 && !(meta->flags & CURLWS_CONT)) {
+                std::string message;
+                message.swap(incoming);
+                on_transport_message(message.c_str());
+            }
+        }
+    }
+
+    void send_frame(const std::string& message, std::function<void(bool)> done)
+    {
+        if (!curl) {
+            done(false);
+            return;
+        }
+
+        pending_frame = message;
+        pending_offset = 0;
+        pending_done = std::move(done);
+        continue_send();
+    }
+
+    // The message goes out as one frame: the first call announces its full
+    // size, the ones after a partial send continue its payload. Without
+    // CURLWS_OFFSET, each call would start a new frame.
+    void continue_send()
+    {
+        while (pending_offset < pending_frame.size()) {
+            size_t sent = 0;
+            const curl_off_t frame_size = pending_offset ? 0 : static_cast<curl_off_t>(pending_frame.size());
+            const CURLcode res = curl_ws_send(curl, pending_frame.data() + pending_offset,
+                pending_frame.size() - pending_offset, &sent, frame_size, CURLWS_TEXT | CURLWS_OFFSET);
+            pending_offset += sent;
+
+            if (res == CURLE_AGAIN) {
+                if (!write_watch) {
+                    write_watch = g_io_create_watch(channel, G_IO_OUT);
+                    g_source_set_callback(write_watch, (GSourceFunc) on_writable, this, nullptr);
+                    g_source_attach(write_watch, context);
+                }
+                return;
+            }
+
+            if (res != CURLE_OK) {
+                on_connection_lost();
+                return;
+            }
+        }
+
+        if (write_watch) {
+            g_source_destroy(write_watch);
+            g_source_unref(write_watch);
+            write_watch = nullptr;
+        }
+
+        pending_frame.clear();
+        auto done = std::move(pending_done);
+        pending_done = nullptr;
+        done(true);
+    }
+
+    static gboolean on_writable(GIOChannel*, GIOCondition, gpointer data)
+    {
+        auto self = static_cast<WebSocketSignalingConnection*>(data);
+        if (self->pending_done)
+            self->continue_send();
+        return G_SOURCE_CONTINUE;
+    }
+
+    std::string url;
+
+    GMainContext* context = nullptr;
+
+    std::unique_ptr<HttpMulti> multi;
+    CURL* connecting = nullptr;
+
+    CURL* curl = nullptr;
+    GIOChannel* channel = nullptr;
+    GSource* read_watch = nullptr;
+    GSource* write_watch = nullptr;
+
+    std::string incoming;
+
+    std::string pending_frame;
+    size_t pending_offset = 0;
+    std::function<void(bool)> pending_done;
+
+    bool handshake_started = false;
+    int reconnect_attempts = 0;
+    GSource* reconnect_timer = nullptr;
+
+    std::unique_ptr<OutboundQueue> outbound;
+};
+
+} // namespace
+
+std::unique_ptr<ISignalingConnection> make_websocket_signaling_connection(std::string sid,
+    const std::string& relay_url)
+{
+    return std::make_unique<WebSocketSignalingConnection>(std::move(sid), relay_url);
+}